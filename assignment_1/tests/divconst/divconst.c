@@ -0,0 +1,16 @@
+int divconst(int x, unsigned u)
+{
+    // Signed division by a power of two rounds towards zero, so negative x are biased before the shift
+    int a = x / 8;
+    int b = x % -4;
+    // Other constants use a multiply high by a magic number, see -local-opts-div-magic
+    int c = x / 7;
+    unsigned d = u / 10;
+    unsigned e = u % 3;
+    return a + b + c + d + e;
+}
+
+int main()
+{
+    return divconst(-100, 1000);
+}
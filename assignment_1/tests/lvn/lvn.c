@@ -0,0 +1,18 @@
+int lvn(int *p, int a, int b)
+{
+    // b + a computes the same value as a + b, and the second load of *p reads the same
+    // memory since nothing was stored in between. The load after the store gets the stored value
+    int x = a + b;
+    int y = b + a;
+    int l1 = *p;
+    int l2 = *p;
+    *p = x;
+    int l3 = *p;
+    return x * y + l1 + l2 + l3;
+}
+
+int main()
+{
+    int v = 5;
+    return lvn(&v, 1, 2);
+}
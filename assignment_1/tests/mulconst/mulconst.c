@@ -0,0 +1,14 @@
+int mulconst(int x)
+{
+    // x * 7 = (x << 3) - x and x * 10 = (x << 1) + (x << 3) are faster than the multiply.
+    // x * 45 = y * 9 with y = x * 5 is only emitted on targets where it is, see -local-opts-cost-model
+    int a = x * 7;
+    int b = x * 45;
+    int c = x * 10;
+    return a + b + c;
+}
+
+int main()
+{
+    return mulconst(3);
+}
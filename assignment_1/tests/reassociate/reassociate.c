@@ -0,0 +1,16 @@
+int reassociate(int a, int b, int c)
+{
+    // Both chains are rewritten as ((a + b) + c) + 8, with their constants combined,
+    // so they end up computing the same value in the same order
+    int x = ((a + 3) + b) + (c + 5);
+    int y = (c + (b + 6)) + (a + 2);
+    // The same for a chain of products and one of xors, where b ^ b cancels
+    int z = (4 * a) * (b * 2);
+    int w = (a ^ b) ^ (c ^ b);
+    return (x == y) + z + w;
+}
+
+int main()
+{
+    return reassociate(1, 2, 3);
+}
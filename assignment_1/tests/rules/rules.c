@@ -0,0 +1,20 @@
+int rules(int x, unsigned u)
+{
+    // One identity per line, each is matched through the rule table of its opcode
+    int a = x - x;
+    int b = x / x;
+    int c = x % 1;
+    int d = x << 0;
+    int e = x & x;
+    int f = x | 0;
+    int g = x ^ x;
+    // Strength reductions by powers of two, the unsigned division becomes a logical shift
+    int h = x * 8;
+    unsigned i = u / 4;
+    return a + b + c + d + e + f + g + h + i;
+}
+
+int main()
+{
+    return rules(3, 16);
+}
@@ -0,0 +1,20 @@
+typedef int int4 __attribute__((vector_size(16)));
+
+int4 vector(int4 x)
+{
+    // The splat constants are folded and matched like scalars: x * 1 and x + 0 are identities,
+    // x * 8 becomes a shift and x / 4 a biased shift on every lane
+    int4 one = {1, 1, 1, 1};
+    int4 zero = {0, 0, 0, 0};
+    int4 eight = {8, 8, 8, 8};
+    int4 four = {4, 4, 4, 4};
+    int4 a = x * one + zero;
+    return a * eight + a / four + (one + one);
+}
+
+int main()
+{
+    int4 x = {1, -2, 3, -4};
+    int4 r = vector(x);
+    return r[0] + r[1] + r[2] + r[3];
+}
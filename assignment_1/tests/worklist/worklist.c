@@ -0,0 +1,15 @@
+int worklist(int x, int y)
+{
+    // x * 1 is replaced with x, which makes the + 0 of its user foldable in the same run,
+    // and so on down the chain
+    int a = x * 1;
+    int b = a + 0;
+    int c = b * 1;
+    int d = c + 0;
+    return d + y / 1;
+}
+
+int main()
+{
+    return worklist(3, 4);
+}
@@ -0,0 +1,25 @@
+int counter;
+int last;
+
+int update(int x)
+{
+    // The first store to counter is overwritten on both paths before being read
+    counter = x;
+    if (x > 10)
+    {
+        counter = x - 10;
+        last = 1;
+    }
+    else
+    {
+        counter = x + 10;
+        last = 2;
+    }
+    last = counter;
+    return last;
+}
+
+int main()
+{
+    return update(5);
+}
@@ -0,0 +1,21 @@
+int compute(int a, int b, int c)
+{
+    int x = a * b;
+    int y = 0;
+    if (c)
+    {
+        // a * b is available from the entry block, this computation is replaced
+        y = a * b + 1;
+    }
+    else
+    {
+        y = a + b;
+    }
+    // a + b is only computed on one of the paths, so it is not available here. a * b is
+    return x + y + (a + b) + a * b;
+}
+
+int main()
+{
+    return compute(7, 3, 1);
+}
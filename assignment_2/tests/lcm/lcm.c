@@ -0,0 +1,27 @@
+#include <stdlib.h>
+
+void check(int b)
+{
+    if (b == 0)
+    {
+        exit(1);
+    }
+}
+
+int compute(int a, int b, int c)
+{
+    int x = 0;
+    if (c)
+    {
+        // a + b and a / b are partially redundant with the computations after the join
+        x = (a + b) + a / b;
+    }
+    check(b);
+    // a + b is moved to the other path, a / b stays after the call since it may trap when b is 0
+    return x + (a + b) + a / b;
+}
+
+int main()
+{
+    return compute(7, 3, 1);
+}
@@ -0,0 +1,24 @@
+; The result of an invoke is computed by the callee: the PHI merging it with 0 is not a constant
+declare i32 @h()
+declare i32 @__gxx_personality_v0(...)
+
+define i32 @f() personality i32 (...)* @__gxx_personality_v0 {
+entry:
+  %c = call i32 @h()
+  %t = icmp eq i32 %c, 0
+  br i1 %t, label %merge, label %call
+
+call:
+  %r = invoke i32 @h() to label %normal unwind label %lpad
+
+normal:
+  br label %merge
+
+lpad:
+  %l = landingpad { i8*, i32 } cleanup
+  ret i32 -1
+
+merge:
+  %p = phi i32 [ %r, %normal ], [ 0, %entry ]
+  ret i32 %p
+}
@@ -0,0 +1,21 @@
+int sccp(int n)
+{
+    // x stays 1 on every path that can run, so the test below is folded and the block
+    // assigning 2 is deleted as unreachable
+    int x = 1;
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (x != 1)
+        {
+            x = 2;
+        }
+        sum += x * 4;
+    }
+    return sum;
+}
+
+int main()
+{
+    return sccp(10);
+}
@@ -0,0 +1,20 @@
+; The switch on a constant is folded: both of its edges to %merge are removed from the PHI of %merge
+define i32 @f(i32 %a) {
+entry:
+  switch i32 2, label %merge [
+    i32 0, label %merge
+    i32 2, label %live
+  ]
+
+live:
+  br label %merge
+
+merge:
+  %p = phi i32 [ 1, %entry ], [ 1, %entry ], [ %a, %live ]
+  ret i32 %p
+}
+
+define i32 @main() {
+  %r = call i32 @f(i32 7)
+  ret i32 %r
+}
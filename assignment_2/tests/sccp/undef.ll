@@ -0,0 +1,23 @@
+; An undef operand is folded as a constant: %m is 0, so the branch on %c makes %two executable and %p is not 1
+define i32 @g(i1 %b) {
+entry:
+  %s = add i32 undef, 0
+  %m = and i32 %s, 0
+  %c = icmp eq i32 %m, 0
+  br i1 %b, label %check, label %out
+
+check:
+  br i1 %c, label %two, label %out
+
+two:
+  br label %out
+
+out:
+  %p = phi i32 [ 1, %entry ], [ 1, %check ], [ 2, %two ]
+  ret i32 %p
+}
+
+define i32 @main() {
+  %r = call i32 @g(i1 true)
+  ret i32 %r
+}
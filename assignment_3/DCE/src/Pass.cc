@@ -5,8 +5,14 @@
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Local.h>
 #include "Dataflow/dataflow.h"
+#include "Purity/purity.h"
 
 // using namespace llvm;
 namespace llvm
@@ -51,11 +57,20 @@ namespace llvm
         }
     }
 
-    bool isLive(Instruction &I)
+    bool isLive(Instruction &I, PurityPass *purity = nullptr)
     {
+        if (I.isTerminator() || isa<DbgInfoIntrinsic>(&I) || isa<LandingPadInst>(&I))
+        {
+            return true;
+        }
+
+        // Calls that the purity analysis proved to have no side effects are only live if their result is used
+        if (purity != nullptr && purity->isRemovableCall(&I))
+        {
+            return false;
+        }
 
-        return I.isTerminator() ||
-               isa<DbgInfoIntrinsic>(&I) || isa<LandingPadInst>(&I) || I.mayHaveSideEffects();
+        return I.mayHaveSideEffects();
     }
 
     bool isAssignmentInstruction(Instruction &I)
@@ -66,36 +81,39 @@ namespace llvm
         // function calls are also of similar nature.
         // However, if return type of an inst is void, it is sure to NOT return a value
         // Store Instructions are technically assignment instructions only
-
-        // TODO: Deal with function calls.
+        // Calls returning a value are assignments too, isLive decides whether they may be removed
         return !(I.getType()->isVoidTy());
     }
 
     /**
      * @brief The Dataflow analysis class for faint analysis. This class defines all the operators and attributes for DFA
+     * Faint sets are only stored at basic block boundaries. The sets of the instructions inside a block
+     * are recomputed with a single backward sweep over the block whenever they are needed
      *
      */
     class DCEDFA
     {
     public:
         std::vector<Value *> faintVariables;
+        DenseMap<Value *, unsigned> faintVariableIdx;
+
+        // FaintIn of the first instruction and FaintOut of the terminator of every block
+        ValueMap<BasicBlock *, BitVector> FaintInBB;
+        ValueMap<BasicBlock *, BitVector> FaintOutBB;
 
-        ValueMap<Instruction *, BitVector> FaintGenS;
-        ValueMap<Instruction *, BitVector> FaintKillS;
-        ValueMap<Instruction *, BitVector> FaintInS;
-        ValueMap<Instruction *, BitVector> FaintOutS;
+        // FaintOut of every instruction of the block that was swept last
+        BasicBlock *sweptBlock = nullptr;
+        DenseMap<Instruction *, BitVector> sweptFaintOutS;
 
-        DCEDFA(Function &F)
+        // Decides which instructions are live, see isLive
+        PurityPass *purity;
+
+        DCEDFA(Function &F, PurityPass *purity = nullptr) : purity(purity)
         {
             for (auto &BB : F)
             {
-                for (auto &I : BB)
-                {
-                    FaintGenS[&I] = BitVector(256, false);
-                    FaintInS[&I] = BitVector(256, false);
-                    FaintOutS[&I] = BitVector(256, false);
-                    FaintKillS[&I] = BitVector(256, false);
-                }
+                FaintInBB[&BB] = BitVector(256, false);
+                FaintOutBB[&BB] = BitVector(256, false);
             }
         }
 
@@ -111,30 +129,37 @@ namespace llvm
             outs() << "  ]    ";
         }
 
-        std::pair<BitVector, BitVector> getGenAndKillSet(Instruction &I)
+        unsigned getVariableIdx(Value *V)
         {
-            // Cannot cache Kill set since they are dependent
+            auto itr = faintVariableIdx.find(V);
+            if (itr != faintVariableIdx.end())
+            {
+                return itr->second;
+            }
+            faintVariables.push_back(V);
+            faintVariableIdx[V] = faintVariables.size() - 1;
+            return faintVariables.size() - 1;
+        }
 
+        // The Gen and Kill sets of an instruction depend on its FaintOut set, since the DFA is non seperable
+        std::pair<BitVector, BitVector> getGenAndKillSet(Instruction &I, BitVector &FaintOutS)
+        {
             // In SSA IR, genSet will be equal to lhs for faint analysis
             // since a variable cannot appear on both lhs and rhs of a statement
 
             BitVector UseS(256, false);
-            BitVector Rhs(256, false);
-
-            FaintKillS[&I].reset();
+            BitVector FaintGenS(256, false);
+            BitVector FaintKillS(256, false);
 
             if (isAssignmentInstruction(I) == true)
             {
 
                 // Calculating GenSetS (same as Lhs in SSA)
-                if (std::find(faintVariables.begin(), faintVariables.end(), dyn_cast<Value>(&I)) == faintVariables.end())
-                {
-                    faintVariables.push_back(&I);
-                }
-                FaintGenS[&I].set(std::find(faintVariables.begin(), faintVariables.end(), dyn_cast<Value>(&I)) - faintVariables.begin());
+                unsigned lhsIdx = getVariableIdx(&I);
+                FaintGenS.set(lhsIdx);
 
-                // Calculating DepKillS
-                if (FaintOutS[&I][std::find(faintVariables.begin(), faintVariables.end(), dyn_cast<Value>(&I)) - faintVariables.begin()] == 0)
+                // A live instruction (e.g a call with side effects) is kept even if its result is faint, so its operands are used
+                if (isLive(I, purity))
                 {
                     for (auto &operandUse : I.operands())
                     {
@@ -144,11 +169,21 @@ namespace llvm
                         {
                             continue;
                         }
-                        if (std::find(faintVariables.begin(), faintVariables.end(), operand) == faintVariables.end())
+                        UseS.set(getVariableIdx(operand));
+                    }
+                }
+                // Calculating DepKillS
+                else if (FaintOutS[lhsIdx] == 0)
+                {
+                    for (auto &operandUse : I.operands())
+                    {
+                        auto operand = operandUse.get();
+
+                        if (isa<Constant>(operand))
                         {
-                            faintVariables.push_back(operand);
+                            continue;
                         }
-                        FaintKillS[&I].set(std::find(faintVariables.begin(), faintVariables.end(), operand) - faintVariables.begin());
+                        FaintKillS.set(getVariableIdx(operand));
                     }
                 }
             }
@@ -156,18 +191,12 @@ namespace llvm
             else
             {
                 // Calculating UseS
-                // TODO: Deal with function calls for UseS
                 if (isa<CallInst>(&I))
                 {
                     auto callInst = dyn_cast<CallInst>(&I);
                     for (auto &argUse : callInst->args())
                     {
-                        auto arg = argUse.get();
-                        if (std::find(faintVariables.begin(), faintVariables.end(), arg) == faintVariables.end())
-                        {
-                            faintVariables.push_back(arg);
-                        }
-                        UseS.set(std::find(faintVariables.begin(), faintVariables.end(), arg) - faintVariables.begin());
+                        UseS.set(getVariableIdx(argUse.get()));
                     }
                 }
                 else if (isa<BranchInst>(&I))
@@ -175,12 +204,7 @@ namespace llvm
                     auto branchInst = dyn_cast<BranchInst>(&I);
                     if (branchInst->isConditional() == true)
                     {
-                        auto condVar = branchInst->getCondition();
-                        if (std::find(faintVariables.begin(), faintVariables.end(), condVar) == faintVariables.end())
-                        {
-                            faintVariables.push_back(condVar);
-                        }
-                        UseS.set(std::find(faintVariables.begin(), faintVariables.end(), condVar) - faintVariables.begin());
+                        UseS.set(getVariableIdx(branchInst->getCondition()));
                     }
                 }
                 else
@@ -191,28 +215,23 @@ namespace llvm
                         auto operand = I.getOperand(i);
                         if (isa<Constant>(operand))
                             continue;
-                        if (std::find(faintVariables.begin(), faintVariables.end(), operand) == faintVariables.end())
-                        {
-                            faintVariables.push_back(operand);
-                        }
-                        UseS.set(std::find(faintVariables.begin(), faintVariables.end(), operand) - faintVariables.begin());
+                        UseS.set(getVariableIdx(operand));
                     }
                 }
             }
 
-            FaintKillS[&I] |= UseS;
-            return std::pair<BitVector, BitVector>(FaintGenS[&I], FaintKillS[&I]);
+            FaintKillS |= UseS;
+            return std::pair<BitVector, BitVector>(FaintGenS, FaintKillS);
         }
 
-        BitVector transferFunc(Instruction &I)
+        BitVector transferFunc(Instruction &I, BitVector &FaintOutS)
         {
-
             BitVector newFaintInS(256, false);
 
             BitVector FaintGenS(256, false), FaintKillS(256, false);
-            std::tie<BitVector, BitVector>(FaintGenS, FaintKillS) = getGenAndKillSet(I);
+            std::tie<BitVector, BitVector>(FaintGenS, FaintKillS) = getGenAndKillSet(I, FaintOutS);
 
-            newFaintInS |= FaintOutS[&I];
+            newFaintInS |= FaintOutS;
             FaintKillS.flip();
             newFaintInS &= FaintKillS;
 
@@ -220,103 +239,432 @@ namespace llvm
             return newFaintInS;
         }
 
-        // Meet Operator to be applies on successors of an Instruction since this DFA is non seperable
-        // Basicblocks however, can only be exited on a branching instruction (or terminators).
-        // To get successors of such branching instructions, we'll therefore actually use the first instruction
-        // of the successor basic blocks of these blocks.
-        BitVector meetOp(Instruction &I)
+        // Meet Operator to be applied on the successors of a block's terminator since this DFA is non seperable.
+        // Inside a block, the FaintOut of an instruction is simply the FaintIn of the next one
+        BitVector meetOp(BasicBlock &BB)
         {
             BitVector newOut(256, true);
-            if (isa<ReturnInst>(&I))
+            auto terminator = BB.getTerminator();
+            if (isa<ReturnInst>(terminator))
             {
                 // Out[Exit node] = T
                 return newOut;
             }
-            if (isa<BranchInst>(&I))
+            if (terminator->getNumSuccessors() == 0)
             {
-
-                auto BB = I.getParent();
-                for (auto successorBB : successors(BB))
-                {
-                    auto &successorInst = successorBB->front();
-                    newOut &= FaintInS[&successorInst];
-                }
+                // Nothing is known to be faint at other exits (e.g unreachable)
+                newOut.reset();
                 return newOut;
             }
 
-            auto successorInst = I.getNextNode();
-            newOut &= FaintInS[successorInst];
+            for (auto successorBB : successors(&BB))
+            {
+                newOut &= FaintInBB[successorBB];
+            }
             return newOut;
         }
 
-        void performDFA(Function &F)
+        /**
+         * @brief Backward sweep over a block, starting from the FaintOut of its terminator
+         * @param sweptFaintOutS - If not null, the FaintOut of every instruction is recorded here
+         * @return BitVector - The FaintIn of the first instruction of the block
+         */
+        BitVector sweepBlock(BasicBlock &BB, DenseMap<Instruction *, BitVector> *sweptFaintOutS)
         {
-            bool changed = true;
-
-            auto &bbList = F.getBasicBlockList();
-
-            std::vector<Instruction *> insts;
-
-            for (auto bb = bbList.rbegin(); bb != bbList.rend(); ++bb)
+            BitVector FaintS = FaintOutBB[&BB];
+            for (auto inst = BB.rbegin(); inst != BB.rend(); ++inst)
             {
-                for (auto inst = (*bb).rbegin(); inst != (*bb).rend(); ++inst)
+                if (sweptFaintOutS != nullptr)
                 {
-                    insts.push_back(&(*inst));
+                    (*sweptFaintOutS)[&(*inst)] = FaintS;
                 }
+                FaintS = transferFunc(*inst, FaintS);
             }
+            return FaintS;
+        }
+
+        void performDFA(Function &F)
+        {
+            bool changed = true;
+
+            auto &bbList = F.getBasicBlockList();
 
             // BACKWARDS PASS
 
             while (changed == true)
             {
                 changed = false;
-                for (auto inst : insts)
+                for (auto bb = bbList.rbegin(); bb != bbList.rend(); ++bb)
                 {
+                    auto &BB = *bb;
 
-                    auto oldOut = FaintOutS[inst];
-                    auto oldIn = FaintInS[inst];
-
-                    auto newOut = meetOp(*inst);
-
-                    FaintOutS[inst].reset();
-                    FaintOutS[inst] |= newOut;
-
-                    auto newIn = transferFunc(*inst);
-                    FaintInS[inst].reset();
-                    FaintInS[inst] |= newIn;
+                    auto newOut = meetOp(BB);
+                    if (newOut != FaintOutBB[&BB])
+                    {
+                        FaintOutBB[&BB] = newOut;
+                        changed = true;
+                    }
 
-                    if ((oldOut != FaintOutS[inst]) || (oldIn != FaintInS[inst]))
+                    auto newIn = sweepBlock(BB, nullptr);
+                    if (newIn != FaintInBB[&BB])
+                    {
+                        FaintInBB[&BB] = newIn;
                         changed = true;
+                    }
                 }
             }
 
-            for (auto inst : insts)
+            for (auto bb = bbList.rbegin(); bb != bbList.rend(); ++bb)
             {
-                outs() << *inst << " ::: ";
-                printSet(FaintOutS[inst]);
-                printSet(FaintInS[inst]);
+                outs() << getShortValueName(&(*bb)) << " ::: ";
+                printSet(FaintOutBB[&(*bb)]);
+                printSet(FaintInBB[&(*bb)]);
                 outs() << "\n\n";
             }
         }
 
         bool canBeRemoved(Instruction &I)
         {
+            if (sweptBlock != I.getParent())
+            {
+                sweptFaintOutS.clear();
+                sweepBlock(*I.getParent(), &sweptFaintOutS);
+                sweptBlock = I.getParent();
+            }
 
-            int bit = std::find(faintVariables.begin(), faintVariables.end(), &I) - faintVariables.begin();
-            return (FaintOutS[&I][bit] == 1);
+            int bit = getVariableIdx(&I);
+            return (sweptFaintOutS[&I][bit] == 1);
         }
     };
 
+    static cl::opt<bool> AggressiveDCE("dce-aggressive",
+                                       cl::desc("Use worklist based mark and sweep instead of faint analysis"),
+                                       cl::init(false));
+
+    static cl::opt<bool> ControlDCE("dce-control",
+                                    cl::desc("Use mark and sweep with control dependences to also remove dead branches"),
+                                    cl::init(false));
+
     class DCEPass : public FunctionPass
     {
     public:
         static char ID;
+        PurityPass *purity = nullptr;
+
+        /**
+         * @brief Mark and sweep DCE. Every live instruction is a root, and everything it uses
+         * transitively is live too. Each instruction enters the worklist at most once, so this is O(N)
+         *
+         */
+        bool runAggressiveDCE(Function &F)
+        {
+            DenseSet<Instruction *> alive;
+            SmallVector<Instruction *, 128> workList;
+
+            // MARK
+            for (auto &BB : F)
+            {
+                for (auto &I : BB)
+                {
+                    if (isLive(I, purity))
+                    {
+                        alive.insert(&I);
+                        workList.push_back(&I);
+                    }
+                }
+            }
+
+            while (!workList.empty())
+            {
+                auto I = workList.pop_back_val();
+                for (auto &operandUse : I->operands())
+                {
+                    auto operand = dyn_cast<Instruction>(operandUse.get());
+                    if (operand != nullptr && alive.insert(operand).second)
+                    {
+                        workList.push_back(operand);
+                    }
+                }
+            }
+
+            // SWEEP
+            std::vector<Instruction *> deadInsts;
+            for (auto &BB : F)
+            {
+                for (auto &I : BB)
+                {
+                    if (alive.count(&I) == 0)
+                    {
+                        outs() << I << " Can Be Removed\n";
+                        deadInsts.push_back(&I);
+                    }
+                }
+            }
+
+            // Dead instructions may use each other, so drop every reference before erasing any
+            for (auto I : deadInsts)
+            {
+                I->dropAllReferences();
+            }
+            for (auto I : deadInsts)
+            {
+                I->eraseFromParent();
+            }
+
+            return !deadInsts.empty();
+        }
+
+        // Blocks that end with a branch which is the source of a back edge. Removing such a branch
+        // could remove an infinite loop, so they are always kept
+        DenseSet<BasicBlock *> getBackEdgeSources(Function &F)
+        {
+            DenseSet<BasicBlock *> backEdgeSources;
+            DenseSet<BasicBlock *> visited;
+            DenseSet<BasicBlock *> onStack;
+            SmallVector<std::pair<BasicBlock *, succ_iterator>, 32> stack;
+
+            visited.insert(&F.getEntryBlock());
+            onStack.insert(&F.getEntryBlock());
+            stack.push_back(std::make_pair(&F.getEntryBlock(), succ_begin(&F.getEntryBlock())));
+            while (!stack.empty())
+            {
+                auto BB = stack.back().first;
+                auto &succ = stack.back().second;
+                if (succ == succ_end(BB))
+                {
+                    onStack.erase(BB);
+                    stack.pop_back();
+                    continue;
+                }
+                auto succBB = *succ;
+                ++succ;
+                if (onStack.count(succBB))
+                {
+                    backEdgeSources.insert(BB);
+                }
+                else if (visited.insert(succBB).second)
+                {
+                    onStack.insert(succBB);
+                    stack.push_back(std::make_pair(succBB, succ_begin(succBB)));
+                }
+            }
+            return backEdgeSources;
+        }
+
+        /**
+         * @brief Mark and sweep DCE that also removes dead control flow.
+         * Branches are not live by themselves. A branch becomes live when a block that is control
+         * dependent on it contains a live instruction, or when a live PHI needs to know which edge was taken.
+         * Dead branches are replaced with a jump to their immediate post dominator, and the blocks
+         * that become unreachable or empty are removed
+         *
+         */
+        bool runControlDCE(Function &F)
+        {
+            PostDominatorTree PDT(F);
+
+            // Control dependences. A block is control dependent on the branches of controlDeps[block]
+            DenseMap<BasicBlock *, SmallVector<BasicBlock *, 4>> controlDeps;
+            for (auto &BB : F)
+            {
+                auto node = PDT.getNode(&BB);
+                if (node == nullptr || BB.getTerminator()->getNumSuccessors() < 2)
+                {
+                    continue;
+                }
+                auto ipdom = node->getIDom();
+                for (auto succBB : successors(&BB))
+                {
+                    auto runner = PDT.getNode(succBB);
+                    while (runner != nullptr && runner != ipdom && runner->getBlock() != nullptr)
+                    {
+                        controlDeps[runner->getBlock()].push_back(&BB);
+                        runner = runner->getIDom();
+                    }
+                }
+            }
+
+            DenseSet<Instruction *> alive;
+            DenseSet<BasicBlock *> aliveBlocks;
+            SmallVector<Instruction *, 128> workList;
+
+            auto markAlive = [&](Instruction *I) {
+                if (alive.insert(I).second)
+                {
+                    workList.push_back(I);
+                }
+            };
+
+            // MARK
+            DenseSet<BasicBlock *> backEdgeSources = getBackEdgeSources(F);
+            for (auto &BB : F)
+            {
+                for (auto &I : BB)
+                {
+                    if (isa<BranchInst>(&I) || isa<SwitchInst>(&I))
+                    {
+                        if (backEdgeSources.count(&BB))
+                        {
+                            markAlive(&I);
+                        }
+                        continue;
+                    }
+                    if (isLive(I, purity))
+                    {
+                        markAlive(&I);
+                    }
+                }
+            }
+
+            while (!workList.empty())
+            {
+                auto I = workList.pop_back_val();
+                for (auto &operandUse : I->operands())
+                {
+                    if (auto operand = dyn_cast<Instruction>(operandUse.get()))
+                    {
+                        markAlive(operand);
+                    }
+                }
+
+                if (auto phi = dyn_cast<PHINode>(I))
+                {
+                    for (auto incomingBB : phi->blocks())
+                    {
+                        markAlive(incomingBB->getTerminator());
+                    }
+                }
+
+                if (aliveBlocks.insert(I->getParent()).second)
+                {
+                    for (auto controllingBB : controlDeps[I->getParent()])
+                    {
+                        markAlive(controllingBB->getTerminator());
+                    }
+                }
+            }
+
+            // SWEEP
+            bool changed = false;
+
+            // Redirect dead branches to the immediate post dominator
+            for (auto &BB : F)
+            {
+                auto terminator = BB.getTerminator();
+                if (alive.count(terminator) || !(isa<BranchInst>(terminator) || isa<SwitchInst>(terminator)))
+                {
+                    continue;
+                }
+                if (isa<BranchInst>(terminator) && dyn_cast<BranchInst>(terminator)->isUnconditional())
+                {
+                    continue;
+                }
+                auto node = PDT.getNode(&BB);
+                if (node == nullptr || node->getIDom() == nullptr || node->getIDom()->getBlock() == nullptr)
+                {
+                    continue;
+                }
+
+                auto target = node->getIDom()->getBlock();
+                outs() << *terminator << " Can Be Removed\n";
+
+                // Keep one edge to the post dominator, if there was one already
+                bool keptEdge = false;
+                for (auto succBB : successors(&BB))
+                {
+                    if (succBB == target && !keptEdge)
+                    {
+                        keptEdge = true;
+                        continue;
+                    }
+                    succBB->removePredecessor(&BB);
+                }
+                if (!keptEdge)
+                {
+                    for (auto &phi : target->phis())
+                    {
+                        phi.addIncoming(UndefValue::get(phi.getType()), &BB);
+                    }
+                }
+
+                BranchInst::Create(target, terminator);
+                terminator->eraseFromParent();
+                changed = true;
+            }
+
+            // Remove dead instructions
+            std::vector<Instruction *> deadInsts;
+            for (auto &BB : F)
+            {
+                for (auto &I : BB)
+                {
+                    if (alive.count(&I) == 0 && !I.isTerminator())
+                    {
+                        outs() << I << " Can Be Removed\n";
+                        deadInsts.push_back(&I);
+                    }
+                }
+            }
+            for (auto I : deadInsts)
+            {
+                I->dropAllReferences();
+            }
+            for (auto I : deadInsts)
+            {
+                I->eraseFromParent();
+            }
+            changed |= !deadInsts.empty();
+
+            // Remove the blocks that are no longer reachable, and then the empty ones
+            changed |= removeUnreachableBlocks(F);
+
+            std::vector<BasicBlock *> emptyBlocks;
+            for (auto &BB : F)
+            {
+                if (&BB != &F.getEntryBlock() && BB.size() == 1 && isa<BranchInst>(BB.getTerminator()) &&
+                    dyn_cast<BranchInst>(BB.getTerminator())->isUnconditional())
+                {
+                    emptyBlocks.push_back(&BB);
+                }
+            }
+            for (auto BB : emptyBlocks)
+            {
+                changed |= TryToSimplifyUncondBranchFromEmptyBlock(BB);
+            }
+
+            std::vector<BasicBlock *> mergeableBlocks;
+            for (auto &BB : F)
+            {
+                auto predBB = BB.getSinglePredecessor();
+                if (predBB != nullptr && predBB->getSingleSuccessor() == &BB)
+                {
+                    mergeableBlocks.push_back(&BB);
+                }
+            }
+            for (auto BB : mergeableBlocks)
+            {
+                changed |= MergeBlockIntoPredecessor(BB);
+            }
+
+            return changed;
+        }
 
         virtual bool runOnFunction(Function &F) override
         {
+            purity = &getAnalysis<PurityPass>();
+
+            if (ControlDCE)
+            {
+                return runControlDCE(F);
+            }
+            if (AggressiveDCE)
+            {
+                return runAggressiveDCE(F);
+            }
+
             // auto dcedfa = new DCEDFA();
 
-            auto dcedfa = new DCEDFA(F);
+            auto dcedfa = new DCEDFA(F, purity);
 
             dcedfa->performDFA(F);
 
@@ -332,10 +680,29 @@ namespace llvm
                 }
             }
 
+            DenseSet<Instruction *> deadSet;
+            std::vector<Instruction *> deadInsts;
+            SmallVector<Instruction *, 64> workList;
+
+            auto markDead = [&](Instruction *I) {
+                if (deadSet.insert(I).second)
+                {
+                    deadInsts.push_back(I);
+                    workList.push_back(I);
+                }
+            };
+
             for (auto I : insts)
             {
 
-                if (isLive(*I) || !(isAssignmentInstruction(*I)))
+                if (!isLive(*I, purity) && !isAssignmentInstruction(*I))
+                {
+                    // A call without side effects whose result is not used at all
+                    outs() << *I << " Can Be Removed\n";
+                    markDead(I);
+                    continue;
+                }
+                if (isLive(*I, purity) || !(isAssignmentInstruction(*I)))
                     continue;
                 // If the result of an assignment instruction is in FaintOut of the instruction
                 // then we can remove it as the assigned variable isn't used further
@@ -343,16 +710,61 @@ namespace llvm
                 outs() << *I << (canRemove ? " Can" : " Can't")
                        << " Be Removed\n";
                 if (canRemove)
-                    I->eraseFromParent();
+                    markDead(I);
             }
 
-            return false;
+            // Removing an instruction may leave its operands without any users,
+            // so re-check them until nothing else becomes dead
+            while (!workList.empty())
+            {
+                auto I = workList.pop_back_val();
+                for (auto &operandUse : I->operands())
+                {
+                    auto operand = dyn_cast<Instruction>(operandUse.get());
+                    if (operand == nullptr || deadSet.count(operand) || isLive(*operand, purity))
+                    {
+                        continue;
+                    }
+
+                    bool allUsersDead = true;
+                    for (auto user : operand->users())
+                    {
+                        if (deadSet.count(dyn_cast<Instruction>(user)) == 0)
+                        {
+                            allUsersDead = false;
+                            break;
+                        }
+                    }
+                    if (allUsersDead)
+                    {
+                        outs() << *operand << " Can Be Removed\n";
+                        markDead(operand);
+                    }
+                }
+            }
+
+            // Dead instructions may use each other, so drop every reference before erasing any
+            for (auto I : deadInsts)
+            {
+                I->dropAllReferences();
+            }
+            for (auto I : deadInsts)
+            {
+                I->eraseFromParent();
+            }
+
+            return !deadInsts.empty();
         }
 
         virtual void
         getAnalysisUsage(AnalysisUsage &AU) const override
         {
-            AU.setPreservesAll();
+            AU.addRequired<PurityPass>();
+            // Removing dead branches changes the CFG, the other modes only erase non terminator instructions
+            if (!ControlDCE)
+            {
+                AU.setPreservesCFG();
+            }
         }
 
         DCEPass() : FunctionPass(ID){};
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LIVENESS_H__
+#define __LIVENESS_H__
+
+#include "dataflow.h"
+
+#include "llvm/IR/Function.h"
+
+namespace llvm
+{
+
+    /**
+     * @brief Liveness DFA. A value is live at a point if it may be used afterwards.
+     * The domain holds every argument and every instruction producing a value, and is
+     * built up front so that getVariableIdx can be used before the DFA is performed
+     *
+     */
+    class LivenessDataFlow : public Dataflow<Value *>
+    {
+    private:
+        DenseMap<Value *, int> variableIdx;
+
+    public:
+        LivenessDataFlow(Function &F) : Dataflow(BACKWARDS)
+        {
+            for (auto &arg : F.args())
+            {
+                addVariable(&arg);
+            }
+            for (auto &BB : F)
+            {
+                for (auto &I : BB)
+                {
+                    if (!I.getType()->isVoidTy())
+                    {
+                        addVariable(&I);
+                    }
+                }
+            }
+
+            for (auto &BB : F)
+            {
+                // For Liveness analysis In[EXIT] = NULL
+                InBB[&BB] = BitVector(256, false);
+                OutBB[&BB] = BitVector(256, false);
+            }
+        }
+
+        void addVariable(Value *V)
+        {
+            variableIdx[V] = getDomain().size();
+            getDomain().push_back(V);
+        }
+
+        bool isTooLarge()
+        {
+            return getDomain().size() > 256;
+        }
+
+        int getVariableIdx(Value *V)
+        {
+            auto idx = variableIdx.find(V);
+            return (idx != variableIdx.end()) ? idx->second : -1;
+        }
+
+        /**
+         * @brief Computes the live values before an instruction, given the live values after it
+         */
+        void transferInst(Instruction &I, BitVector &live)
+        {
+            int defIdx = getVariableIdx(&I);
+            if (defIdx != -1)
+            {
+                live.reset(defIdx);
+            }
+            for (auto &op : I.operands())
+            {
+                int useIdx = getVariableIdx(op.get());
+                if (useIdx != -1)
+                {
+                    live.set(useIdx);
+                }
+            }
+        }
+
+        BitVector meetOp(std::vector<BitVector> meetCandidates) override
+        {
+            BitVector newOut = BitVector(256, false);
+            for (auto &candidate : meetCandidates)
+            {
+                newOut |= candidate;
+            }
+            return newOut;
+        }
+
+        BitVector transferFunc(BasicBlock &BB) override
+        {
+            BitVector useSet, defSet;
+            std::tie(useSet, defSet) = getGenAndKillSet(BB);
+
+            auto newIn = defSet.flip();
+            newIn &= OutBB[&BB];
+            newIn |= useSet;
+            return newIn;
+        }
+
+        // Gen is the set of values used before being defined in the block, Kill the set of defined values
+        std::pair<BitVector, BitVector> getGenAndKillSet(BasicBlock &BB) override
+        {
+            if ((GenBB.find(&BB) != GenBB.end()) && (KillBB.find(&BB) != KillBB.end()))
+            {
+                return std::pair<BitVector, BitVector>(GenBB[&BB], KillBB[&BB]);
+            }
+
+            BitVector useSet(256, false);
+            BitVector defSet(256, false);
+            for (auto inst = BB.rbegin(); inst != BB.rend(); ++inst)
+            {
+                int defIdx = getVariableIdx(&*inst);
+                if (defIdx != -1)
+                {
+                    defSet.set(defIdx);
+                }
+                transferInst(*inst, useSet);
+            }
+
+            GenBB.insert(std::pair<BasicBlock *, BitVector>(&BB, useSet));
+            KillBB.insert(std::pair<BasicBlock *, BitVector>(&BB, defSet));
+
+            return std::pair<BitVector, BitVector>(useSet, defSet);
+        }
+    };
+}
+
+#endif
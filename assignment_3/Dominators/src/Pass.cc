@@ -0,0 +1,488 @@
+////////////////////////////////////////////////////////////////////////////////
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace llvm
+{
+
+    /**
+     * @brief Dominator tree of a function. Every reachable block stores its immediate dominator and its depth in the tree,
+     * so dominance queries walk up the tree instead of looking up dominator sets.
+     * The tree is computed once per function. Passes that change the CFG keep it up to date with insertBlock, insertEdge
+     * and deleteEdge, which only visit the part of the tree affected by the change (like LLVM's DomTreeUpdater)
+     *
+     */
+    class DominatorsPass : public FunctionPass
+    {
+    private:
+        Function *function = nullptr;
+        DenseMap<BasicBlock *, BasicBlock *> idom;
+        DenseMap<BasicBlock *, unsigned> level;
+        DenseMap<BasicBlock *, SmallVector<BasicBlock *, 4>> children;
+
+        /**
+         * @brief Computes the immediate dominators of the blocks reached from start through blocks of the region,
+         * with the iterative algorithm of Cooper, Harvey and Kennedy. start is the root of the computation,
+         * every other block of the region that is reached gets its immediate dominator in newIdom
+         *
+         * @param rpo - The blocks reached, in reverse post order
+         */
+        void computeIdoms(BasicBlock *start, std::function<bool(BasicBlock *)> inRegion,
+                          SmallVectorImpl<BasicBlock *> &rpo, DenseMap<BasicBlock *, BasicBlock *> &newIdom)
+        {
+            DenseMap<BasicBlock *, unsigned> postorder;
+            SmallVector<BasicBlock *, 32> postorderList;
+            SmallVector<std::pair<BasicBlock *, succ_iterator>, 32> stack;
+            DenseSet<BasicBlock *> visited;
+
+            visited.insert(start);
+            stack.push_back(std::make_pair(start, succ_begin(start)));
+            while (!stack.empty())
+            {
+                auto &top = stack.back();
+                if (top.second != succ_end(top.first))
+                {
+                    BasicBlock *succ = *top.second;
+                    ++top.second;
+                    if (inRegion(succ) && visited.insert(succ).second)
+                    {
+                        stack.push_back(std::make_pair(succ, succ_begin(succ)));
+                    }
+                }
+                else
+                {
+                    postorder[top.first] = postorderList.size();
+                    postorderList.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
+            rpo.assign(postorderList.rbegin(), postorderList.rend());
+
+            auto intersect = [&](BasicBlock *A, BasicBlock *B) {
+                while (A != B)
+                {
+                    while (postorder[A] < postorder[B])
+                    {
+                        A = newIdom[A];
+                    }
+                    while (postorder[B] < postorder[A])
+                    {
+                        B = newIdom[B];
+                    }
+                }
+                return A;
+            };
+
+            newIdom[start] = start;
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                for (auto BB : rpo)
+                {
+                    if (BB == start)
+                    {
+                        continue;
+                    }
+                    BasicBlock *candidate = nullptr;
+                    for (auto pred : predecessors(BB))
+                    {
+                        // Predecessors that were not reached (or not processed yet) are skipped
+                        if (newIdom.find(pred) == newIdom.end())
+                        {
+                            continue;
+                        }
+                        candidate = (candidate == nullptr) ? pred : intersect(pred, candidate);
+                    }
+                    if (newIdom.lookup(BB) != candidate)
+                    {
+                        newIdom[BB] = candidate;
+                        changed = true;
+                    }
+                }
+            }
+            newIdom.erase(start);
+        }
+
+        // Adds the blocks computed by computeIdoms below their immediate dominators, parents first
+        void attachBlocks(BasicBlock *start, SmallVectorImpl<BasicBlock *> &rpo, DenseMap<BasicBlock *, BasicBlock *> &newIdom)
+        {
+            for (auto BB : rpo)
+            {
+                if (BB == start)
+                {
+                    continue;
+                }
+                idom[BB] = newIdom[BB];
+                level[BB] = level[newIdom[BB]] + 1;
+                children[newIdom[BB]].push_back(BB);
+            }
+        }
+
+        void setIDom(BasicBlock *BB, BasicBlock *newIDom)
+        {
+            auto &siblings = children[idom[BB]];
+            siblings.erase(std::find(siblings.begin(), siblings.end(), BB));
+            idom[BB] = newIDom;
+            children[newIDom].push_back(BB);
+        }
+
+        // Recomputes the depth of BB and of the blocks it dominates
+        void updateLevels(BasicBlock *BB)
+        {
+            SmallVector<BasicBlock *, 32> workList;
+            workList.push_back(BB);
+            while (!workList.empty())
+            {
+                auto node = workList.pop_back_val();
+                level[node] = level[idom[node]] + 1;
+                for (auto child : children[node])
+                {
+                    workList.push_back(child);
+                }
+            }
+        }
+
+        /**
+         * @brief Recomputes the subtree of root, after an edge between blocks of the subtree was removed.
+         * root still dominates every block of its subtree that is reachable, the others became unreachable
+         *
+         */
+        void rebuildSubtree(BasicBlock *root)
+        {
+            DenseSet<BasicBlock *> subtree;
+            SmallVector<BasicBlock *, 32> workList;
+            subtree.insert(root);
+            workList.push_back(root);
+            while (!workList.empty())
+            {
+                auto node = workList.pop_back_val();
+                for (auto child : children[node])
+                {
+                    subtree.insert(child);
+                    workList.push_back(child);
+                }
+            }
+
+            SmallVector<BasicBlock *, 32> rpo;
+            DenseMap<BasicBlock *, BasicBlock *> newIdom;
+            computeIdoms(
+                root, [&](BasicBlock *BB) { return subtree.count(BB) != 0; }, rpo, newIdom);
+
+            for (auto BB : subtree)
+            {
+                children[BB].clear();
+                if (BB != root && newIdom.find(BB) == newIdom.end())
+                {
+                    idom.erase(BB);
+                    level.erase(BB);
+                    children.erase(BB);
+                }
+            }
+            attachBlocks(root, rpo, newIdom);
+        }
+
+        /**
+         * @brief Insertion of an edge between two reachable blocks. Based on the depth based search of
+         * Georgiadis et al. (also used by LLVM): a block is affected iff it is deeper than the nearest common dominator + 1
+         * and reached from to through blocks at least as deep as itself. Every affected block is then
+         * immediately dominated by the nearest common dominator
+         *
+         */
+        void insertReachable(BasicBlock *from, BasicBlock *to)
+        {
+            BasicBlock *ncd = findNearestCommonDominator(from, to);
+            if (ncd == to || ncd == idom[to])
+            {
+                return;
+            }
+            unsigned ncdLevel = level[ncd];
+
+            std::priority_queue<std::pair<unsigned, BasicBlock *>> bucket;
+            DenseSet<BasicBlock *> visited;
+            SmallVector<BasicBlock *, 16> affected;
+            bucket.push(std::make_pair(level[to], to));
+            visited.insert(to);
+
+            while (!bucket.empty())
+            {
+                BasicBlock *BB = bucket.top().second;
+                bucket.pop();
+                affected.push_back(BB);
+                unsigned currentLevel = level[BB];
+
+                SmallVector<BasicBlock *, 16> unaffectedOnCurrentLevel;
+                while (true)
+                {
+                    for (auto succ : successors(BB))
+                    {
+                        if (!isReachable(succ) || level[succ] <= ncdLevel + 1 || !visited.insert(succ).second)
+                        {
+                            continue;
+                        }
+                        if (level[succ] > currentLevel)
+                        {
+                            unaffectedOnCurrentLevel.push_back(succ);
+                        }
+                        else
+                        {
+                            bucket.push(std::make_pair(level[succ], succ));
+                        }
+                    }
+                    if (unaffectedOnCurrentLevel.empty())
+                    {
+                        break;
+                    }
+                    BB = unaffectedOnCurrentLevel.pop_back_val();
+                }
+            }
+
+            for (auto BB : affected)
+            {
+                setIDom(BB, ncd);
+            }
+            for (auto BB : affected)
+            {
+                updateLevels(BB);
+            }
+        }
+
+        // Insertion of an edge to a block that was not reachable. The blocks it makes reachable get their
+        // dominators below from, and their edges back into the tree are then inserted one by one
+        void insertUnreachable(BasicBlock *from, BasicBlock *to)
+        {
+            DenseSet<BasicBlock *> region;
+            SmallVector<BasicBlock *, 32> workList;
+            SmallVector<std::pair<BasicBlock *, BasicBlock *>, 8> edgesIntoTree;
+            region.insert(to);
+            workList.push_back(to);
+            while (!workList.empty())
+            {
+                auto BB = workList.pop_back_val();
+                for (auto succ : successors(BB))
+                {
+                    if (isReachable(succ))
+                    {
+                        edgesIntoTree.push_back(std::make_pair(BB, succ));
+                    }
+                    else if (region.insert(succ).second)
+                    {
+                        workList.push_back(succ);
+                    }
+                }
+            }
+
+            SmallVector<BasicBlock *, 32> rpo;
+            DenseMap<BasicBlock *, BasicBlock *> newIdom;
+            computeIdoms(
+                from, [&](BasicBlock *BB) { return region.count(BB) != 0; }, rpo, newIdom);
+            attachBlocks(from, rpo, newIdom);
+
+            for (auto &edge : edgesIntoTree)
+            {
+                insertReachable(edge.first, edge.second);
+            }
+        }
+
+    public:
+        static char ID;
+
+        DominatorsPass() : FunctionPass(ID){};
+
+        bool runOnFunction(Function &F) override
+        {
+            recalculate(F);
+            return false;
+        }
+
+        void recalculate(Function &F)
+        {
+            function = &F;
+            idom.clear();
+            level.clear();
+            children.clear();
+
+            BasicBlock *root = &F.getEntryBlock();
+            idom[root] = nullptr;
+            level[root] = 0;
+
+            SmallVector<BasicBlock *, 32> rpo;
+            DenseMap<BasicBlock *, BasicBlock *> newIdom;
+            computeIdoms(
+                root, [](BasicBlock *) { return true; }, rpo, newIdom);
+            attachBlocks(root, rpo, newIdom);
+        }
+
+        bool isReachable(BasicBlock *BB)
+        {
+            return idom.find(BB) != idom.end();
+        }
+
+        BasicBlock *getIDom(BasicBlock *BB)
+        {
+            return idom.lookup(BB);
+        }
+
+        /**
+         * @brief Checks if A dominates B. Blocks that are not in the tree (unreachable or unknown) are
+         * neither dominated nor dominating, so callers stay conservative
+         */
+        bool dominates(BasicBlock *A, BasicBlock *B)
+        {
+            if (!isReachable(A) || !isReachable(B))
+            {
+                return false;
+            }
+            while (level[B] > level[A])
+            {
+                B = idom[B];
+            }
+            return A == B;
+        }
+
+        BasicBlock *findNearestCommonDominator(BasicBlock *A, BasicBlock *B)
+        {
+            while (A != B)
+            {
+                if (level[A] >= level[B])
+                {
+                    A = idom[A];
+                }
+                else
+                {
+                    B = idom[B];
+                }
+            }
+            return A;
+        }
+
+        /**
+         * @brief Get the dominators of a block, from the block itself up to the entry
+         */
+        std::vector<BasicBlock *> getDomList(BasicBlock *BB)
+        {
+            std::vector<BasicBlock *> domList;
+            if (!isReachable(BB))
+            {
+                return domList;
+            }
+            for (; BB != nullptr; BB = idom[BB])
+            {
+                domList.push_back(BB);
+            }
+            return domList;
+        }
+
+        /**
+         * @brief Update after newBB was inserted in front of succ, taking over some of its predecessors
+         * (e.g. with SplitEdge or SplitBlockPredecessors)
+         */
+        void insertBlock(BasicBlock *newBB, BasicBlock *succ)
+        {
+            BasicBlock *newIDom = nullptr;
+            for (auto pred : predecessors(newBB))
+            {
+                if (isReachable(pred))
+                {
+                    newIDom = (newIDom == nullptr) ? pred : findNearestCommonDominator(newIDom, pred);
+                }
+            }
+            if (newIDom == nullptr)
+            {
+                return;
+            }
+            idom[newBB] = newIDom;
+            level[newBB] = level[newIDom] + 1;
+            children[newIDom].push_back(newBB);
+
+            // succ is dominated by newBB if its other predecessors are only reached through succ itself
+            for (auto pred : predecessors(succ))
+            {
+                if (pred != newBB && isReachable(pred) && !dominates(succ, pred))
+                {
+                    return;
+                }
+            }
+            setIDom(succ, newBB);
+            updateLevels(succ);
+        }
+
+        /**
+         * @brief Update after an edge was added to the CFG
+         */
+        void insertEdge(BasicBlock *from, BasicBlock *to)
+        {
+            if (!isReachable(from))
+            {
+                return;
+            }
+            if (!isReachable(to))
+            {
+                insertUnreachable(from, to);
+                return;
+            }
+            insertReachable(from, to);
+        }
+
+        /**
+         * @brief Update after an edge was removed from the CFG. Only the subtree of the nearest common dominator
+         * of the two blocks can change, so only that subtree is recomputed
+         */
+        void deleteEdge(BasicBlock *from, BasicBlock *to)
+        {
+            if (!isReachable(from) || !isReachable(to))
+            {
+                return;
+            }
+            BasicBlock *ncd = findNearestCommonDominator(from, to);
+            if (ncd == to)
+            {
+                // A back edge, to still dominates from
+                return;
+            }
+            rebuildSubtree(ncd);
+        }
+
+        void print(raw_ostream &O, const Module *M) const override
+        {
+            if (function == nullptr)
+            {
+                return;
+            }
+            for (auto &BB : *function)
+            {
+                O << BB.getName() << " : ";
+                auto itr = idom.find(const_cast<BasicBlock *>(&BB));
+                if (itr == idom.end())
+                {
+                    O << "unreachable\n";
+                    continue;
+                }
+                for (auto dom = itr->second; dom != nullptr; dom = idom.lookup(dom))
+                {
+                    O << dom->getName() << " ";
+                }
+                O << "\n";
+            }
+        }
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override
+        {
+            AU.setPreservesAll();
+        }
+    };
+
+    char DominatorsPass::ID = 0;
+    RegisterPass<DominatorsPass> D("dominators", "Dominator Tree");
+}
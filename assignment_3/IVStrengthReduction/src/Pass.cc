@@ -0,0 +1,203 @@
+#include <llvm/Analysis/LoopPass.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/IR/IRBuilder.h>
+
+#include <utility>
+
+namespace llvm
+{
+    /**
+     * @brief A basic induction variable: a header PHI starting at init and increased by the
+     * loop invariant step on every iteration, through next = phi + step (or phi - step if decreasing)
+     *
+     */
+    struct BasicIV
+    {
+        PHINode *phi;
+        Value *init;
+        Value *step;
+        Instruction *next;
+        bool decreasing;
+    };
+
+    /**
+     * @brief Induction variable strength reduction. A multiplication of a basic induction variable by a
+     * loop invariant, iv * c, is replaced by a new induction variable starting at init * c and increased by
+     * step * c, so the loop only adds. The new variables are basic induction variables too, so iv * c * d is
+     * reduced as well. Induction variables left unused (only updating themselves) are removed
+     *
+     */
+    class IVStrengthReductionPass : public LoopPass
+    {
+    public:
+        static char ID;
+        IVStrengthReductionPass() : LoopPass(ID){};
+
+        /**
+         * @brief Finds the basic induction variables of the loop. Like the PHI handling of the loop rotation
+         * in LICM, the values of a header PHI are taken for its preheader and latch edges
+         *
+         */
+        SmallVector<BasicIV, 8> findBasicIVs(Loop *L, BasicBlock *preheader, BasicBlock *latch)
+        {
+            SmallVector<BasicIV, 8> ivs;
+            for (auto &phi : L->getHeader()->phis())
+            {
+                if (!phi.getType()->isIntegerTy() || phi.getNumIncomingValues() != 2)
+                {
+                    continue;
+                }
+                Value *init = phi.getIncomingValueForBlock(preheader);
+                auto next = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(latch));
+                if (next == nullptr || !L->contains(next))
+                {
+                    continue;
+                }
+
+                Value *step = nullptr;
+                if (next->getOpcode() == Instruction::Add && (next->getOperand(0) == &phi || next->getOperand(1) == &phi))
+                {
+                    step = (next->getOperand(0) == &phi) ? next->getOperand(1) : next->getOperand(0);
+                }
+                else if (next->getOpcode() == Instruction::Sub && next->getOperand(0) == &phi)
+                {
+                    step = next->getOperand(1);
+                }
+                if (step == nullptr || !L->isLoopInvariant(step))
+                {
+                    continue;
+                }
+                ivs.push_back({&phi, init, step, next, next->getOpcode() == Instruction::Sub});
+            }
+            return ivs;
+        }
+
+        // Multiplies in the preheader. Products by 0 or 1 (e.g the start or the step of a counter) are not emitted,
+        // otherwise they would be new multiplications of the parent loop's induction variables
+        Value *createProduct(IRBuilder<> &builder, Value *lhs, Value *rhs)
+        {
+            for (auto operands : {std::make_pair(lhs, rhs), std::make_pair(rhs, lhs)})
+            {
+                auto C = dyn_cast<ConstantInt>(operands.first);
+                if (C != nullptr && C->isZero())
+                {
+                    return C;
+                }
+                if (C != nullptr && C->isOne())
+                {
+                    return operands.second;
+                }
+            }
+            return builder.CreateMul(lhs, rhs);
+        }
+
+        /**
+         * @brief Creates the induction variable iv * factor: a header PHI starting at init * factor in the
+         * preheader, and increased by step * factor right after the increment of iv
+         *
+         */
+        BasicIV createScaledIV(const BasicIV &iv, Value *factor, BasicBlock *preheader, BasicBlock *latch)
+        {
+            IRBuilder<> preheaderBuilder(preheader->getTerminator());
+            auto init = createProduct(preheaderBuilder, iv.init, factor);
+            auto step = createProduct(preheaderBuilder, iv.step, factor);
+            if (iv.decreasing)
+            {
+                step = preheaderBuilder.CreateNeg(step);
+            }
+
+            auto phi = PHINode::Create(iv.phi->getType(), 2, iv.phi->getName() + ".scaled", iv.phi);
+            IRBuilder<> nextBuilder(iv.next->getNextNode());
+            auto next = cast<Instruction>(nextBuilder.CreateAdd(phi, step, phi->getName() + ".next"));
+
+            phi->addIncoming(init, preheader);
+            phi->addIncoming(next, latch);
+            return {phi, init, step, next, false};
+        }
+
+        virtual bool runOnLoop(Loop *L, LPPassManager &LPM) override
+        {
+            // The new induction variables start in the preheader and are updated along the single back edge
+            auto preheader = L->getLoopPreheader();
+            auto latch = L->getLoopLatch();
+            if (preheader == nullptr || latch == nullptr)
+            {
+                return false;
+            }
+
+            outs() << "Performing Induction Variable Strength Reduction\n";
+
+            auto ivs = findBasicIVs(L, preheader, latch);
+
+            // The scaled variables of every (iv, factor), so that equal multiplications share one
+            DenseMap<std::pair<PHINode *, Value *>, PHINode *> scaled;
+            SmallVector<Instruction *, 16> reduced;
+
+            // New variables are appended to ivs, so their own multiplications are reduced as well
+            for (size_t i = 0; i < ivs.size(); ++i)
+            {
+                auto iv = ivs[i];
+                SmallVector<BinaryOperator *, 8> muls;
+                for (auto user : iv.phi->users())
+                {
+                    auto mul = dyn_cast<BinaryOperator>(user);
+                    if (mul != nullptr && mul->getOpcode() == Instruction::Mul && L->contains(mul))
+                    {
+                        Value *factor = (mul->getOperand(0) == iv.phi) ? mul->getOperand(1) : mul->getOperand(0);
+                        if (factor != iv.phi && L->isLoopInvariant(factor))
+                        {
+                            muls.push_back(mul);
+                        }
+                    }
+                }
+
+                for (auto mul : muls)
+                {
+                    Value *factor = (mul->getOperand(0) == iv.phi) ? mul->getOperand(1) : mul->getOperand(0);
+                    auto &phi = scaled[std::make_pair(iv.phi, factor)];
+                    if (phi == nullptr)
+                    {
+                        auto scaledIV = createScaledIV(iv, factor, preheader, latch);
+                        phi = scaledIV.phi;
+                        ivs.push_back(scaledIV);
+                    }
+
+                    outs() << *mul << " Reduced To " << phi->getName() << "\n";
+                    mul->replaceAllUsesWith(phi);
+                    reduced.push_back(mul);
+                }
+            }
+
+            for (auto mul : reduced)
+            {
+                mul->eraseFromParent();
+            }
+
+            // A variable only used by its own increment is dead once its multiplications are gone
+            unsigned deadIVs = 0;
+            for (auto &iv : ivs)
+            {
+                if (RecursivelyDeleteDeadPHINode(iv.phi))
+                {
+                    ++deadIVs;
+                }
+            }
+
+            outs() << "Multiplications Reduced : " << reduced.size() << ", Dead Induction Variables : " << deadIVs
+                   << "\n";
+
+            return !reduced.empty() || deadIVs > 0;
+        }
+
+        virtual void getAnalysisUsage(AnalysisUsage &Info) const override
+        {
+            Info.setPreservesCFG();
+        };
+    };
+    char IVStrengthReductionPass::ID = 0;
+
+    RegisterPass<IVStrengthReductionPass> Y("iv-strength-reduction", "Induction Variable Strength Reduction Pass");
+}
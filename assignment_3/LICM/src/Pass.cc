@@ -1,10 +1,19 @@
 #include <llvm/Analysis/LoopPass.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Operator.h>
 #include "Dataflow/dataflow.h"
+#include "Dataflow/liveness.h"
+#include "Purity/purity.h"
 
 #include "Dominators/src/Pass.cc"
 
@@ -58,340 +67,1615 @@ namespace llvm
         // function calls are also of similar nature.
         // However, if return type of an inst is void, it is sure to NOT return a value
         // Store Instructions are technically assignment instructions only
+        // Calls returning a value are assignments too, but they are only moved if the purity analysis allows it
+        return !(I.getType()->isVoidTy());
+    }
+
+    static cl::opt<bool> NestLICM("licm-nest",
+                                  cl::desc("Hoist invariants of a whole loop nest to the outermost legal preheader"),
+                                  cl::init(false));
+
+    static cl::opt<bool> PromoteLICM("licm-promote",
+                                     cl::desc("Keep loop invariant memory locations in registers across the loop"),
+                                     cl::init(false));
+
+    static cl::opt<bool> SinkLICM("licm-sink",
+                                  cl::desc("Sink instructions only used after the loop into the exit blocks"),
+                                  cl::init(true));
+
+    static cl::opt<bool> UnswitchLICM("licm-unswitch",
+                                      cl::desc("Clone loops for each outcome of a loop invariant branch condition"),
+                                      cl::init(false));
+
+    static cl::opt<unsigned> UnswitchBudget("licm-unswitch-budget",
+                                            cl::desc("Largest loop, in instructions, that is cloned by unswitching"),
+                                            cl::init(100));
+
+    static cl::opt<unsigned> MaxPressureLICM("licm-max-pressure",
+                                             cl::desc("Stop hoisting once this many values may be live in the loop (0 for no limit)"),
+                                             cl::init(16));
+
+    class LICMPass : public LoopPass
+    {
+    public:
+        static char ID;
+        LICMPass() : LoopPass(ID){};
+        SmallVector<Value *, 64> invariants;
+        SmallVector<Value *, 64> codeMotionCandidates;
+        BasicBlock *testBlock = nullptr;
+        BasicBlock *landingpad = nullptr;
+        BasicBlock *preheader = nullptr;
+        BasicBlock *newHeader = nullptr;
+
+        DenseSet<Value *> invariantSet;
+
+        bool isDefOutsideLoop(Value *V, Loop *L)
+        {
+            auto I = dyn_cast<Instruction>(V);
+            return (I == nullptr || !L->contains(I));
+        }
+
+        bool isInvariant(Value *V)
+        {
+            return invariantSet.count(V) != 0;
+        }
+
+        // Instructions that may be moved if all their operands are invariant
+        bool isCodeMotionCandidate(Instruction &I, PurityPass &purity, bool loopWritesMemory)
+        {
+            if (!isAssignmentInstruction(I) || isa<PHINode>(&I))
+            {
+                return false;
+            }
+            if (isa<CallBase>(&I) && !purity.isHoistableCall(&I, loopWritesMemory))
+            {
+                return false;
+            }
+            // A load may see a different value in every iteration if the loop writes memory.
+            // Such locations are only moved out of the loop by scalar promotion
+            if (isa<LoadInst>(&I) && (loopWritesMemory || !dyn_cast<LoadInst>(&I)->isSimple()))
+            {
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Finds the loop invariant instructions in time linear in the size of the loop.
+         * Every candidate counts the uses of operands defined inside the loop that are not known to be invariant.
+         * Candidates without such operands seed a worklist, and every new invariant decrements the count of its users.
+         * Instructions are added to invariants only after their operands, so it is in a valid order for hoisting
+         *
+         */
+        void findInvariants(Loop *L, PurityPass &purity, bool loopWritesMemory)
+        {
+            DenseMap<Instruction *, unsigned> pendingOperands;
+            SmallVector<Instruction *, 64> workList;
+
+            for (auto BB : L->blocks())
+            {
+                for (auto &I : *BB)
+                {
+                    if (!isCodeMotionCandidate(I, purity, loopWritesMemory))
+                    {
+                        continue;
+                    }
+
+                    unsigned pending = 0;
+                    for (auto &op : I.operands())
+                    {
+                        if (!isDefOutsideLoop(op.get(), L))
+                        {
+                            ++pending;
+                        }
+                    }
+                    pendingOperands[&I] = pending;
+                    if (pending == 0)
+                    {
+                        workList.push_back(&I);
+                    }
+                }
+            }
+
+            while (!workList.empty())
+            {
+                auto I = workList.pop_back_val();
+                invariants.push_back(I);
+                invariantSet.insert(I);
+
+                for (auto &use : I->uses())
+                {
+                    auto user = dyn_cast<Instruction>(use.getUser());
+                    auto pending = pendingOperands.find(user);
+                    if (pending == pendingOperands.end() || pending->second == 0)
+                    {
+                        continue;
+                    }
+                    if (--pending->second == 0)
+                    {
+                        workList.push_back(user);
+                    }
+                }
+            }
+        }
+
+        /**
+         * @brief Splits the edges from preds to BB through a new block. The new block is added
+         * to the innermost loop around L that contains BB
+         *
+         */
+        BasicBlock *splitPredecessors(BasicBlock *BB, ArrayRef<BasicBlock *> preds, const char *suffix, Loop *L, LoopInfo &LI)
+        {
+            for (auto pred : preds)
+            {
+                // The targets of these terminators can not be changed
+                if (isa<IndirectBrInst>(pred->getTerminator()) || isa<CallBrInst>(pred->getTerminator()))
+                {
+                    return nullptr;
+                }
+            }
+
+            auto newBB = SplitBlockPredecessors(BB, preds, suffix, static_cast<DominatorTree *>(nullptr), nullptr, nullptr, false);
+            if (newBB == nullptr)
+            {
+                return nullptr;
+            }
+
+            auto loop = L->getParentLoop();
+            while (loop != nullptr && !loop->contains(BB))
+            {
+                loop = loop->getParentLoop();
+            }
+            if (loop != nullptr)
+            {
+                loop->addBasicBlockToLoop(newBB, LI);
+            }
+            getAnalysis<DominatorsPass>().insertBlock(newBB, BB);
+            return newBB;
+        }
+
+        // Gives the loop a preheader, a single block outside the loop that branches to the header
+        BasicBlock *insertPreheader(Loop *L, LoopInfo &LI)
+        {
+            SmallVector<BasicBlock *, 8> outsidePreds;
+            for (auto pred : predecessors(L->getHeader()))
+            {
+                if (!L->contains(pred))
+                {
+                    outsidePreds.push_back(pred);
+                }
+            }
+            if (outsidePreds.empty())
+            {
+                return nullptr;
+            }
+            return splitPredecessors(L->getHeader(), outsidePreds, ".preheader", L, LI);
+        }
+
+        // Makes every exit block of the loop only reachable from the loop
+        bool formDedicatedExits(Loop *L, LoopInfo &LI)
+        {
+            SmallVector<BasicBlock *, 8> exitBlocks;
+            L->getUniqueExitBlocks(exitBlocks);
+            for (auto exitBlock : exitBlocks)
+            {
+                SmallVector<BasicBlock *, 8> loopPreds;
+                bool isDedicated = true;
+                for (auto pred : predecessors(exitBlock))
+                {
+                    if (L->contains(pred))
+                    {
+                        loopPreds.push_back(pred);
+                    }
+                    else
+                    {
+                        isDedicated = false;
+                    }
+                }
+                if (!isDedicated && splitPredecessors(exitBlock, loopPreds, ".loopexit", L, LI) == nullptr)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Checks if BB dominates every exiting block of the loop, so an instruction in BB is executed
+        // whenever the loop is left and can safely be executed before the loop instead
+        bool dominatesExits(BasicBlock *BB, Loop *loop, DominatorsPass &dominators)
+        {
+            SmallVector<BasicBlock *, 8> exitingBlocks;
+            loop->getExitingBlocks(exitingBlocks);
+            for (auto exitingBlock : exitingBlocks)
+            {
+                if (!dominators.dominates(BB, exitingBlock))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Strips casts and address computations to find the object a pointer points into
+        Value *getBaseObject(Value *V)
+        {
+            while (true)
+            {
+                if (auto gep = dyn_cast<GEPOperator>(V))
+                {
+                    V = gep->getPointerOperand();
+                }
+                else if (auto cast = dyn_cast<BitCastOperator>(V))
+                {
+                    V = cast->getOperand(0);
+                }
+                else
+                {
+                    return V;
+                }
+            }
+        }
+
+        // An alloca that is only used by loads and stores of the alloca itself can not be reached
+        // through any other pointer or by any call
+        bool isNonEscapingAlloca(Value *V)
+        {
+            if (!isa<AllocaInst>(V))
+            {
+                return false;
+            }
+            for (auto user : V->users())
+            {
+                if (auto store = dyn_cast<StoreInst>(user))
+                {
+                    if (store->getValueOperand() == V)
+                    {
+                        return false;
+                    }
+                }
+                else if (!isa<LoadInst>(user))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Objects that never overlap with a different object
+        bool isDistinctObject(Value *V)
+        {
+            if (auto arg = dyn_cast<Argument>(V))
+            {
+                return arg->hasNoAliasAttr();
+            }
+            return isa<AllocaInst>(V) || isa<GlobalVariable>(V);
+        }
+
+        // Conservative local alias check. It only proves that pointers into different objects do not overlap
+        bool mayAlias(Value *A, Value *B)
+        {
+            auto baseA = getBaseObject(A);
+            auto baseB = getBaseObject(B);
+            if (baseA == baseB)
+            {
+                return true;
+            }
+            if (isNonEscapingAlloca(baseA) || isNonEscapingAlloca(baseB))
+            {
+                return false;
+            }
+            return !(isDistinctObject(baseA) && isDistinctObject(baseB));
+        }
+
+        // Follow the chain of replacements so that we never reuse an erased value
+        Value *getReplacement(DenseMap<Instruction *, Value *> &replacements, Value *V)
+        {
+            auto I = dyn_cast<Instruction>(V);
+            while (I != nullptr && replacements.find(I) != replacements.end())
+            {
+                V = replacements[I];
+                I = dyn_cast<Instruction>(V);
+            }
+            return V;
+        }
+
+        /**
+         * @brief Checks if a loop invariant location can be kept in a register across the loop.
+         * All the accesses to it in the loop have to be simple loads and stores of the same type,
+         * and no other instruction in the loop may access it
+         *
+         */
+        bool canPromote(Loop *L, Value *pointer, SmallVectorImpl<Instruction *> &accesses,
+                        MapVector<Value *, SmallVector<Instruction *, 8>> &locations,
+                        SmallVectorImpl<Instruction *> &otherMemoryInsts, PurityPass &purity,
+                        DominatorsPass &dominators)
+        {
+            bool isLocal = isNonEscapingAlloca(pointer);
+            Type *type = nullptr;
+            bool hasStore = false;
+            bool accessGuaranteed = false;
+            bool storeGuaranteed = false;
+
+            for (auto I : accesses)
+            {
+                Type *accessType = nullptr;
+                if (auto load = dyn_cast<LoadInst>(I))
+                {
+                    if (!load->isSimple())
+                    {
+                        return false;
+                    }
+                    accessType = load->getType();
+                }
+                else
+                {
+                    auto store = dyn_cast<StoreInst>(I);
+                    if (!store->isSimple() || store->getValueOperand() == pointer)
+                    {
+                        return false;
+                    }
+                    accessType = store->getValueOperand()->getType();
+                    hasStore = true;
+                    storeGuaranteed |= dominatesExits(I->getParent(), L, dominators);
+                }
+                if (type != nullptr && type != accessType)
+                {
+                    return false;
+                }
+                type = accessType;
+                accessGuaranteed |= dominatesExits(I->getParent(), L, dominators);
+            }
+
+            // The pointer may not be used by anything else in the loop (e.g a call or a GEP)
+            for (auto user : pointer->users())
+            {
+                auto I = dyn_cast<Instruction>(user);
+                if (I != nullptr && L->contains(I) && std::find(accesses.begin(), accesses.end(), I) == accesses.end())
+                {
+                    return false;
+                }
+            }
+
+            for (auto &location : locations)
+            {
+                if (location.first != pointer && mayAlias(pointer, location.first))
+                {
+                    return false;
+                }
+            }
+
+            for (auto I : otherMemoryInsts)
+            {
+                if (auto load = dyn_cast<LoadInst>(I))
+                {
+                    if (mayAlias(pointer, load->getPointerOperand()))
+                    {
+                        return false;
+                    }
+                }
+                else if (auto store = dyn_cast<StoreInst>(I))
+                {
+                    if (mayAlias(pointer, store->getPointerOperand()))
+                    {
+                        return false;
+                    }
+                }
+                else if (isLocal)
+                {
+                    continue;
+                }
+                else if (auto call = dyn_cast<CallBase>(I))
+                {
+                    // The stores are delayed to the exits, so they would be lost if the call throws
+                    FunctionPurity callPurity = purity.getCallPurity(call);
+                    if (!callPurity.readNone || !callPurity.noUnwind)
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    return false;
+                }
+            }
+
+            // Loading before the loop is only safe if the location is known to be valid
+            if (!accessGuaranteed && !isa<AllocaInst>(pointer) && !isa<GlobalVariable>(pointer))
+            {
+                return false;
+            }
+
+            // Storing on every exit must not introduce a store another thread could see
+            if (hasStore && !storeGuaranteed && !isLocal)
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Scalar promotion. Every loop invariant location that can not be accessed other than through
+         * its own loads and stores is loaded once before the loop. Its loads and stores in the loop are replaced
+         * with SSA values, and the value is stored back to memory on every exit of the loop
+         *
+         */
+        bool promoteScalars(Loop *L, PurityPass &purity)
+        {
+            BasicBlock *loopPreheader = L->getLoopPreheader();
+            if (loopPreheader == nullptr || !L->hasDedicatedExits())
+            {
+                return false;
+            }
+
+            SmallVector<BasicBlock *, 8> exitBlocks;
+            L->getUniqueExitBlocks(exitBlocks);
+            for (auto exitBlock : exitBlocks)
+            {
+                if (exitBlock->getFirstInsertionPt() == exitBlock->end())
+                {
+                    return false;
+                }
+            }
+
+            auto &dominators = getAnalysis<DominatorsPass>();
+
+            // Accesses of every loop invariant pointer, in program order within each block
+            MapVector<Value *, SmallVector<Instruction *, 8>> locations;
+            SmallVector<Instruction *, 32> otherMemoryInsts;
+            for (auto BB : L->blocks())
+            {
+                for (auto &I : *BB)
+                {
+                    Value *pointer = nullptr;
+                    if (auto load = dyn_cast<LoadInst>(&I))
+                    {
+                        pointer = load->getPointerOperand();
+                    }
+                    else if (auto store = dyn_cast<StoreInst>(&I))
+                    {
+                        pointer = store->getPointerOperand();
+                    }
+
+                    if (pointer != nullptr && isDefOutsideLoop(pointer, L))
+                    {
+                        locations[pointer].push_back(&I);
+                    }
+                    else if (I.mayReadOrWriteMemory() || I.mayThrow())
+                    {
+                        otherMemoryInsts.push_back(&I);
+                    }
+                }
+            }
+
+            SmallVector<Value *, 8> promotable;
+            for (auto &location : locations)
+            {
+                if (canPromote(L, location.first, location.second, locations, otherMemoryInsts, purity, dominators))
+                {
+                    promotable.push_back(location.first);
+                }
+            }
+
+            for (auto pointer : promotable)
+            {
+                auto &accesses = locations[pointer];
+                Type *type = isa<LoadInst>(accesses.front()) ? accesses.front()->getType()
+                                                             : dyn_cast<StoreInst>(accesses.front())->getValueOperand()->getType();
+
+                auto preheaderLoad = new LoadInst(type, pointer, pointer->getName() + ".promoted", loopPreheader->getTerminator());
+
+                SmallVector<PHINode *, 8> insertedPhis;
+                SSAUpdater SSA(&insertedPhis);
+                SSA.Initialize(type, preheaderLoad->getName());
+                SSA.AddAvailableValue(loopPreheader, preheaderLoad);
+
+                // The last store of every block gives the value at its end
+                bool hasStore = false;
+                for (auto I : accesses)
+                {
+                    if (auto store = dyn_cast<StoreInst>(I))
+                    {
+                        SSA.AddAvailableValue(I->getParent(), store->getValueOperand());
+                        hasStore = true;
+                    }
+                }
+
+                // A load sees the last store before it in its block, or the value on entry to the block
+                DenseMap<Instruction *, Value *> replacements;
+                DenseMap<BasicBlock *, Value *> currentValue;
+                for (auto I : accesses)
+                {
+                    if (auto store = dyn_cast<StoreInst>(I))
+                    {
+                        currentValue[I->getParent()] = store->getValueOperand();
+                        continue;
+                    }
+                    auto current = currentValue.find(I->getParent());
+                    replacements[I] = (current != currentValue.end()) ? current->second
+                                                                      : SSA.GetValueInMiddleOfBlock(I->getParent());
+                }
+
+                if (hasStore)
+                {
+                    for (auto exitBlock : exitBlocks)
+                    {
+                        new StoreInst(SSA.GetValueInMiddleOfBlock(exitBlock), pointer, &*exitBlock->getFirstInsertionPt());
+                    }
+                }
+
+                for (auto I : accesses)
+                {
+                    if (isa<LoadInst>(I))
+                    {
+                        I->replaceAllUsesWith(getReplacement(replacements, I));
+                    }
+                }
+                for (auto I : accesses)
+                {
+                    if (isa<StoreInst>(I))
+                    {
+                        I->eraseFromParent();
+                    }
+                }
+                for (auto I : accesses)
+                {
+                    if (isa<LoadInst>(I))
+                    {
+                        I->eraseFromParent();
+                    }
+                }
+
+                // PHIs that only merge a value with itself are not needed
+                bool changed = true;
+                while (changed)
+                {
+                    changed = false;
+                    for (auto &phi : insertedPhis)
+                    {
+                        if (phi == nullptr)
+                        {
+                            continue;
+                        }
+                        Value *V = phi->hasConstantValue();
+                        if (V != nullptr && V != phi)
+                        {
+                            phi->replaceAllUsesWith(V);
+                            phi->eraseFromParent();
+                            phi = nullptr;
+                            changed = true;
+                        }
+                    }
+                }
+
+                outs() << getShortValueName(pointer) << " Promoted To A Register\n";
+            }
+
+            return !promotable.empty();
+        }
+
+        // Instructions that compute the same value when they are executed after the loop instead
+        bool isSinkCandidate(Instruction &I, PurityPass &purity, bool loopWritesMemory)
+        {
+            if (!isAssignmentInstruction(I) || isa<PHINode>(&I) || I.isEHPad() || isa<AllocaInst>(&I) || I.use_empty())
+            {
+                return false;
+            }
+            if (isa<CallBase>(&I))
+            {
+                return purity.isHoistableCall(&I, loopWritesMemory);
+            }
+            if (auto load = dyn_cast<LoadInst>(&I))
+            {
+                return load->isSimple() && !loopWritesMemory;
+            }
+            return !I.mayReadOrWriteMemory() && !I.mayHaveSideEffects();
+        }
+
+        /**
+         * @brief Sinks the instructions whose results are only used after the loop into the exit blocks.
+         * An instruction that dominates an exit block computes the same value there as in the last iteration,
+         * since none of its operands can be redefined between its last execution and the exit.
+         * Every use is given a copy in the exit block that dominates it, so an instruction used after
+         * several exits is duplicated. Blocks are visited bottom up so the users of an instruction are sunk first
+         *
+         */
+        bool sinkToExits(Loop *L, PurityPass &purity, bool loopWritesMemory)
+        {
+            SmallVector<BasicBlock *, 8> exitBlocks;
+            L->getUniqueExitBlocks(exitBlocks);
+            if (exitBlocks.empty())
+            {
+                return false;
+            }
+
+            auto &dominators = getAnalysis<DominatorsPass>();
+
+            // Blocks of inner loops are left to the inner loop, they were visited before L
+            SmallVector<BasicBlock *, 32> loopBlocks;
+            ReversePostOrderTraversal<Function *> rpot(L->getHeader()->getParent());
+            for (auto BB : rpot)
+            {
+                if (!L->contains(BB))
+                {
+                    continue;
+                }
+                bool inSubLoop = false;
+                for (auto subLoop : L->getSubLoops())
+                {
+                    inSubLoop |= subLoop->contains(BB);
+                }
+                if (!inSubLoop)
+                {
+                    loopBlocks.push_back(BB);
+                }
+            }
+
+            unsigned sunk = 0;
+            for (auto BB = loopBlocks.rbegin(); BB != loopBlocks.rend(); ++BB)
+            {
+                for (auto inst = (*BB)->rbegin(); inst != (*BB)->rend();)
+                {
+                    Instruction &I = *inst++;
+                    if (!isSinkCandidate(I, purity, loopWritesMemory))
+                    {
+                        continue;
+                    }
+
+                    // Find the exit block that dominates every use
+                    DenseMap<Use *, BasicBlock *> useExit;
+                    bool canSink = true;
+                    for (auto &use : I.uses())
+                    {
+                        auto user = dyn_cast<Instruction>(use.getUser());
+                        BasicBlock *useBlock = user->getParent();
+                        if (auto phi = dyn_cast<PHINode>(user))
+                        {
+                            useBlock = phi->getIncomingBlock(use);
+                        }
+                        if (L->contains(useBlock))
+                        {
+                            canSink = false;
+                            break;
+                        }
+
+                        BasicBlock *target = nullptr;
+                        for (auto exitBlock : exitBlocks)
+                        {
+                            if (exitBlock->getFirstInsertionPt() != exitBlock->end() &&
+                                dominators.dominates(I.getParent(), exitBlock) &&
+                                dominators.dominates(exitBlock, useBlock))
+                            {
+                                target = exitBlock;
+                            }
+                        }
+                        if (target == nullptr)
+                        {
+                            canSink = false;
+                            break;
+                        }
+                        useExit[&use] = target;
+                    }
+                    if (!canSink)
+                    {
+                        continue;
+                    }
+
+                    DenseMap<BasicBlock *, Instruction *> copies;
+                    SmallVector<Use *, 8> uses;
+                    for (auto &use : I.uses())
+                    {
+                        uses.push_back(&use);
+                    }
+                    for (auto use : uses)
+                    {
+                        BasicBlock *target = useExit[use];
+                        if (copies.find(target) == copies.end())
+                        {
+                            auto copy = I.clone();
+                            copy->setName(I.getName());
+                            copy->insertBefore(&*target->getFirstInsertionPt());
+                            copies[target] = copy;
+                        }
+                        use->set(copies[target]);
+                    }
+
+                    outs() << I << " Sunk To " << copies.size() << " Exit Blocks\n";
+                    I.eraseFromParent();
+                    ++sunk;
+                }
+            }
+
+            return sunk > 0;
+        }
+
+        void getPreHeader(Loop *L)
+        {
+            BasicBlock *header = L->getHeader();
+            for (auto predecessor : predecessors(header))
+            {
+                if (std::find(L->getBlocksVector().begin(), L->getBlocksVector().end(), predecessor) == L->getBlocksVector().end())
+                {
+                    // This predecessor is not part of loop, this is the preheader
+                    preheader = predecessor;
+                }
+            }
+        }
+
+        /**
+         * @brief Gets the block the loop continues to from its header, if the header is where the loop is left.
+         * Such while loops are rotated so that the exit test is at the bottom of the loop
+         *
+         * @return BasicBlock* - The successor of the header in the loop, or nullptr if the loop does not need rotation
+         */
+        BasicBlock *getRotationBody(Loop *L)
+        {
+            auto header = L->getHeader();
+            auto headerBranch = dyn_cast<BranchInst>(header->getTerminator());
+            if (headerBranch == nullptr || !headerBranch->isConditional())
+            {
+                return nullptr;
+            }
+
+            auto trueDest = headerBranch->getSuccessor(0);
+            auto falseDest = headerBranch->getSuccessor(1);
+            if (L->contains(trueDest) == L->contains(falseDest))
+            {
+                return nullptr;
+            }
+            auto body = L->contains(trueDest) ? trueDest : falseDest;
+            if (body == header)
+            {
+                return nullptr;
+            }
+
+            // The header is copied into the guard
+            for (auto &I : *header)
+            {
+                if (I.isEHPad() || I.getType()->isTokenTy())
+                {
+                    return nullptr;
+                }
+                if (auto call = dyn_cast<CallBase>(&I))
+                {
+                    if (call->cannotDuplicate() || call->isConvergent())
+                    {
+                        return nullptr;
+                    }
+                }
+            }
+            return body;
+        }
+
+        /**
+         * @brief Builds the guard of a rotated loop in the test block. The header is copied into the test block
+         * with its PHIs replaced by their values on entry, so the guard evaluates the first exit test of the loop.
+         * The guard branches to the landing pad if the loop is entered, and to the exit otherwise.
+         * vmap maps every value of the header to its copy in the guard
+         *
+         */
+        void getTestCondition(Loop *L, ValueToValueMapTy &vmap)
+        {
+            auto header = L->getHeader();
+            for (auto &phi : header->phis())
+            {
+                vmap[&phi] = phi.getIncomingValueForBlock(landingpad);
+            }
+
+            auto term = testBlock->getTerminator();
+            for (auto &inst : *header)
+            {
+                if (isa<PHINode>(&inst) || inst.isTerminator())
+                {
+                    continue;
+                }
+                auto newInst = inst.clone();
+                newInst->setName(inst.getName() + ".guard");
+                newInst->insertBefore(term);
+                llvm::RemapInstruction(newInst, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+                vmap[&inst] = newInst;
+            }
+
+            auto getGuardValue = [&](Value *V) -> Value * {
+                auto mapped = vmap.find(V);
+                return (mapped != vmap.end()) ? static_cast<Value *>(mapped->second) : V;
+            };
+
+            auto headerBranch = dyn_cast<BranchInst>(header->getTerminator());
+            BasicBlock *exitBlock = nullptr;
+            BasicBlock *dests[2];
+            for (unsigned i = 0; i < 2; ++i)
+            {
+                auto succ = headerBranch->getSuccessor(i);
+                dests[i] = L->contains(succ) ? landingpad : succ;
+                if (!L->contains(succ))
+                {
+                    exitBlock = succ;
+                }
+            }
+
+            term->eraseFromParent();
+            BranchInst::Create(dests[0], dests[1], getGuardValue(headerBranch->getCondition()), testBlock);
+            getAnalysis<DominatorsPass>().insertEdge(testBlock, exitBlock);
+
+            // The exit is now also reached from the guard
+            for (auto &phi : exitBlock->phis())
+            {
+                phi.addIncoming(getGuardValue(phi.getIncomingValueForBlock(header)), testBlock);
+            }
+        }
+
+        /**
+         * @brief Makes the body the first block of the rotated loop. The landing pad branches to the body,
+         * and every use of a header value outside the header now sees either the header value or its copy
+         * in the guard, depending on the path taken. PHIs merging them are inserted with the SSA updater,
+         * so any number of exits, latches and PHI inputs is supported
+         *
+         */
+        void movePhisToBodyAndExit(Loop *L, BasicBlock *body, ValueToValueMapTy &vmap,
+                                   DenseMap<Value *, SmallVector<PHINode *, 8>> &rotationPhis)
+        {
+            auto header = L->getHeader();
+
+            for (auto &phi : body->phis())
+            {
+                Value *V = phi.getIncomingValueForBlock(header);
+                auto mapped = vmap.find(V);
+                phi.addIncoming((mapped != vmap.end()) ? static_cast<Value *>(mapped->second) : V, landingpad);
+            }
+            header->removePredecessor(landingpad, true);
+            dyn_cast<BranchInst>(landingpad->getTerminator())->setSuccessor(0, body);
+            auto &dominators = getAnalysis<DominatorsPass>();
+            dominators.insertEdge(landingpad, body);
+            dominators.deleteEdge(landingpad, header);
 
-        // TODO: Deal with function calls.
-        return !(I.getType()->isVoidTy());
-    }
+            for (auto &inst : *header)
+            {
+                if (inst.isTerminator())
+                {
+                    continue;
+                }
 
-    class LICMPass : public LoopPass
-    {
-    public:
-        static char ID;
-        LICMPass() : LoopPass(ID){};
-        SmallVector<Value *, 64> invariants;
-        SmallVector<Value *, 64> codeMotionCandidates;
-        BasicBlock *testBlock = nullptr;
-        BasicBlock *landingpad = nullptr;
-        BasicBlock *preheader = nullptr;
-        BasicBlock *newHeader = nullptr;
+                SmallVector<Use *, 16> usesToRewrite;
+                for (auto &use : inst.uses())
+                {
+                    auto user = dyn_cast<Instruction>(use.getUser());
+                    BasicBlock *useBlock = user->getParent();
+                    if (auto phi = dyn_cast<PHINode>(user))
+                    {
+                        useBlock = phi->getIncomingBlock(use);
+                    }
+                    if (useBlock != header && user->getParent() != testBlock)
+                    {
+                        usesToRewrite.push_back(&use);
+                    }
+                }
+                if (usesToRewrite.empty())
+                {
+                    continue;
+                }
 
-        bool isDefOutsideLoop(Value *V, Loop *L)
+                auto &insertedPhis = rotationPhis[&inst];
+                SSAUpdater SSA(&insertedPhis);
+                SSA.Initialize(inst.getType(), inst.getName());
+                SSA.AddAvailableValue(header, &inst);
+                SSA.AddAvailableValue(testBlock, vmap[&inst]);
+                for (auto use : usesToRewrite)
+                {
+                    SSA.RewriteUse(*use);
+                }
+            }
+        }
+
+        /**
+         * @brief Gets the blocks of the loop that are no longer reachable from the header once
+         * the branch only goes to its successor keptSucc
+         *
+         */
+        SmallPtrSet<BasicBlock *, 16> getDeadBlocks(Loop *L, BranchInst *branch, unsigned keptSucc)
         {
+            SmallPtrSet<BasicBlock *, 16> reached;
+            SmallVector<BasicBlock *, 16> workList;
+            reached.insert(L->getHeader());
+            workList.push_back(L->getHeader());
+            while (!workList.empty())
+            {
+                auto BB = workList.pop_back_val();
+                for (unsigned i = 0; i < BB->getTerminator()->getNumSuccessors(); ++i)
+                {
+                    auto succ = BB->getTerminator()->getSuccessor(i);
+                    if (BB == branch->getParent() && i != keptSucc)
+                    {
+                        continue;
+                    }
+                    if (L->contains(succ) && reached.insert(succ).second)
+                    {
+                        workList.push_back(succ);
+                    }
+                }
+            }
 
+            SmallPtrSet<BasicBlock *, 16> dead;
             for (auto BB : L->blocks())
             {
-                for (auto &I : *BB)
+                if (reached.count(BB) == 0)
+                {
+                    dead.insert(BB);
+                }
+            }
+            return dead;
+        }
+
+        // Folding the branch may not remove an inner loop or every back edge of L
+        bool canFoldBranch(Loop *L, BranchInst *branch, unsigned keptSucc)
+        {
+            auto dead = getDeadBlocks(L, branch, keptSucc);
+            for (auto subLoop : L->getSubLoops())
+            {
+                for (auto BB : subLoop->blocks())
                 {
-                    if (dyn_cast<Value>(&I) == V)
+                    if (dead.count(BB) != 0)
                     {
                         return false;
                     }
                 }
             }
-            return true;
+            for (auto pred : predecessors(L->getHeader()))
+            {
+                if (L->contains(pred) && dead.count(pred) == 0 && !(pred == branch->getParent() &&
+                                                                    branch->getSuccessor(keptSucc) != L->getHeader()))
+                {
+                    return true;
+                }
+            }
+            return false;
         }
 
-        bool isInvariant(Value *V)
+        // Makes the branch unconditional and deletes the blocks of the loop that become unreachable
+        void foldBranch(Loop *L, BranchInst *branch, unsigned keptSucc, LoopInfo &LI)
         {
-            return (std::find(invariants.begin(), invariants.end(), V) != invariants.end());
-        }
+            auto dead = getDeadBlocks(L, branch, keptSucc);
 
-        void getPreHeader(Loop *L)
-        {
-            BasicBlock *header = L->getHeader();
-            for (auto predecessor : predecessors(header))
+            auto removedSucc = branch->getSuccessor(1 - keptSucc);
+            if (removedSucc != branch->getSuccessor(keptSucc))
             {
-                if (std::find(L->getBlocksVector().begin(), L->getBlocksVector().end(), predecessor) == L->getBlocksVector().end())
+                removedSucc->removePredecessor(branch->getParent());
+            }
+            BranchInst::Create(branch->getSuccessor(keptSucc), branch);
+            auto branchBB = branch->getParent();
+            branch->eraseFromParent();
+            // Before the dead blocks are erased, they are dropped from the tree as unreachable blocks
+            if (removedSucc != branchBB->getSingleSuccessor())
+            {
+                getAnalysis<DominatorsPass>().deleteEdge(branchBB, removedSucc);
+            }
+
+            for (auto BB : dead)
+            {
+                for (auto succ : successors(BB))
                 {
-                    // This predecessor is not part of loop, this is the preheader
-                    preheader = predecessor;
+                    if (dead.count(succ) == 0)
+                    {
+                        succ->removePredecessor(BB);
+                    }
+                }
+            }
+            for (auto BB : dead)
+            {
+                for (auto &I : *BB)
+                {
+                    I.replaceAllUsesWith(UndefValue::get(I.getType()));
                 }
+                BB->dropAllReferences();
+                LI.removeBlock(BB);
+            }
+            for (auto BB : dead)
+            {
+                BB->eraseFromParent();
             }
         }
 
-        void getTestCondition(Loop *L)
+        /**
+         * @brief Loop unswitching. A branch in the loop on a condition that is invariant (it was hoisted or is
+         * defined before the loop) is tested every iteration. Instead, the loop is cloned and the condition is tested
+         * once in the preheader: the original loop is the version where the condition is true and the clone the version
+         * where it is false. The branch is then unconditional in both versions.
+         * Only loops of at most UnswitchBudget instructions are cloned, and each loop is unswitched at most once per run
+         *
+         */
+        bool unswitchLoop(Loop *L)
         {
+            auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
 
-            auto headerBlock = L->getHeader();
-            auto headerBranch = dyn_cast<BranchInst>(headerBlock->getTerminator());
+            unsigned loopSize = 0;
+            for (auto BB : L->blocks())
+            {
+                loopSize += BB->size();
+            }
+            if (loopSize > UnswitchBudget || L->getLoopPreheader() == nullptr)
+            {
+                return false;
+            }
 
-            if (headerBranch == nullptr)
+            BranchInst *branch = nullptr;
+            for (auto BB : L->blocks())
+            {
+                auto candidate = dyn_cast<BranchInst>(BB->getTerminator());
+                if (candidate == nullptr || !candidate->isConditional() || isa<Constant>(candidate->getCondition()) ||
+                    !isDefOutsideLoop(candidate->getCondition(), L) ||
+                    candidate->getSuccessor(0) == candidate->getSuccessor(1))
+                {
+                    continue;
+                }
+                if (canFoldBranch(L, candidate, 0) && canFoldBranch(L, candidate, 1))
+                {
+                    branch = candidate;
+                    break;
+                }
+            }
+            if (branch == nullptr)
             {
-                outs() << "Error: Header terminator not a branch inst";
-                return;
+                return false;
             }
 
-            if (headerBranch->isConditional() == false)
+            // The exits of both versions have to be reached only from the loop, to merge the values of the versions
+            if (!formDedicatedExits(L, LI))
             {
-                // TODO: Handle non conditional branch to body, so don't do anything
-                return;
+                return false;
             }
-            auto condition = dyn_cast<CmpInst>(headerBranch->getCondition());
 
-            if (condition == nullptr)
+            auto F = L->getHeader()->getParent();
+            auto guard = L->getLoopPreheader();
+            auto loopPreheader = SplitEdge(guard, L->getHeader(), nullptr, &LI, nullptr);
+            loopPreheader->setName(L->getHeader()->getName() + ".us-true");
+            getAnalysis<DominatorsPass>().insertBlock(loopPreheader, L->getHeader());
+
+            // ---------------------
+            // CLONE THE LOOP
+            // ---------------------
+
+            ValueToValueMapTy vmap;
+            SmallVector<BasicBlock *, 32> loopBlocks(L->blocks().begin(), L->blocks().end());
+            auto clonePreheader = BasicBlock::Create(F->getContext(), L->getHeader()->getName() + ".us-false", F);
+            BranchInst::Create(L->getHeader(), clonePreheader);
+            vmap[loopPreheader] = clonePreheader;
+            for (auto BB : loopBlocks)
+            {
+                vmap[BB] = CloneBasicBlock(BB, vmap, ".us", F);
+            }
+            for (auto BB : loopBlocks)
             {
-                outs() << "Conditional for header branch not a Cmp Inst";
-                return;
+                for (auto &I : *dyn_cast<BasicBlock>(vmap[BB]))
+                {
+                    RemapInstruction(&I, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+                }
             }
+            RemapInstruction(clonePreheader->getTerminator(), vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
 
-            auto operandOne = condition->getOperand(0);
-            auto operandTwo = condition->getOperand(1);
+            // The clone has the same loop structure as L
+            DenseMap<Loop *, Loop *> loopMap;
+            auto parentLoop = L->getParentLoop();
+            for (auto loop : L->getLoopsInPreorder())
+            {
+                auto newLoop = LI.AllocateLoop();
+                if (loop == L)
+                {
+                    if (parentLoop != nullptr)
+                    {
+                        parentLoop->addChildLoop(newLoop);
+                    }
+                    else
+                    {
+                        LI.addTopLevelLoop(newLoop);
+                    }
+                }
+                else
+                {
+                    loopMap[loop->getParentLoop()]->addChildLoop(newLoop);
+                }
+                loopMap[loop] = newLoop;
+                // Headers are added first, as the first block of a loop is its header
+                loopMap[loop]->addBasicBlockToLoop(dyn_cast<BasicBlock>(vmap[loop->getHeader()]), LI);
+            }
+            for (auto BB : loopBlocks)
+            {
+                auto newBB = dyn_cast<BasicBlock>(vmap[BB]);
+                if (LI.getLoopFor(newBB) == nullptr)
+                {
+                    loopMap[LI.getLoopFor(BB)]->addBasicBlockToLoop(newBB, LI);
+                }
+            }
+            if (parentLoop != nullptr)
+            {
+                parentLoop->addBasicBlockToLoop(clonePreheader, LI);
+            }
 
-            outs() << getShortValueName(operandOne) << " " << getShortValueName(operandTwo) << "\n";
-            auto header = L->getHeader();
-            for (auto &inst : *header)
+            // The exits are also reached from the clone
+            SmallVector<BasicBlock *, 8> exitBlocks;
+            L->getUniqueExitBlocks(exitBlocks);
+            for (auto exitBlock : exitBlocks)
             {
-                if (dyn_cast<Value>(&inst) == operandOne)
+                for (auto &phi : exitBlock->phis())
                 {
-                    auto phi = dyn_cast<PHINode>(&inst);
-                    if (phi == nullptr)
+                    for (unsigned i = 0, e = phi.getNumIncomingValues(); i < e; ++i)
                     {
-                        outs() << "Test block defines variable outside phi function\n";
-                        return;
+                        if (L->contains(phi.getIncomingBlock(i)))
+                        {
+                            auto V = phi.getIncomingValue(i);
+                            auto mapped = vmap.find(V);
+                            phi.addIncoming((mapped != vmap.end()) ? static_cast<Value *>(mapped->second) : V,
+                                            dyn_cast<BasicBlock>(vmap[phi.getIncomingBlock(i)]));
+                        }
                     }
-                    operandOne = phi->getIncomingValueForBlock(L->getLoopPreheader());
                 }
-                else if (dyn_cast<Value>(&inst) == operandTwo)
+            }
+
+            // Values of the loop used after it now come from either version
+            for (auto BB : loopBlocks)
+            {
+                for (auto &I : *BB)
                 {
-                    auto phi = dyn_cast<PHINode>(&inst);
-                    if (phi == nullptr)
+                    SmallVector<Use *, 8> outsideUses;
+                    for (auto &use : I.uses())
+                    {
+                        auto user = dyn_cast<Instruction>(use.getUser());
+                        BasicBlock *useBlock = user->getParent();
+                        if (auto phi = dyn_cast<PHINode>(user))
+                        {
+                            useBlock = phi->getIncomingBlock(use);
+                        }
+                        if (!L->contains(useBlock) && !loopMap[L]->contains(useBlock))
+                        {
+                            outsideUses.push_back(&use);
+                        }
+                    }
+                    if (outsideUses.empty())
+                    {
+                        continue;
+                    }
+
+                    SSAUpdater SSA;
+                    SSA.Initialize(I.getType(), I.getName());
+                    SSA.AddAvailableValue(BB, &I);
+                    SSA.AddAvailableValue(dyn_cast<BasicBlock>(vmap[BB]), vmap[&I]);
+                    for (auto use : outsideUses)
                     {
-                        outs() << "Test block defines variable outside phi function\n";
-                        return;
+                        SSA.RewriteUse(*use);
                     }
-                    operandTwo = phi->getIncomingValueForBlock(L->getLoopPreheader());
                 }
             }
 
-            // auto newConditional = CmpInst::Create(condition->getOpcode(), condition->getPredicate(), operandOne, operandTwo, "new-cmp", nullptr);
-            auto term = testBlock->getTerminator();
-            term->eraseFromParent();
+            // ---------------------
+            // CHOOSE THE VERSION IN THE PREHEADER
+            // ---------------------
+
+            auto condition = branch->getCondition();
+            guard->getTerminator()->eraseFromParent();
+            BranchInst::Create(loopPreheader, clonePreheader, condition, guard);
+            getAnalysis<DominatorsPass>().insertEdge(guard, clonePreheader);
+
+            auto cloneBranch = dyn_cast<BranchInst>(dyn_cast<Instruction>(vmap[branch]));
+            foldBranch(L, branch, 0, LI);
+            foldBranch(loopMap[L], cloneBranch, 1, LI);
 
-            auto newConditional = CmpInst::Create(condition->getOpcode(), condition->getPredicate(), operandOne, operandTwo, "new-cmp", testBlock);
-            auto newTerm = BranchInst::Create(landingpad, L->getExitBlock(), newConditional, testBlock);
+            outs() << "Unswitched Loop On " << getShortValueName(condition) << "\n";
+
+            return true;
         }
 
-        void movePhisToBodyAndExit(Loop *L, BasicBlock *body)
+        // Rough cost of executing an instruction once, saved every iteration when it is hoisted
+        unsigned getHoistBenefit(Instruction *I)
         {
-            // We have to move phi instructions to the body now, which is the new header
-            auto header = L->getHeader();
-            std::vector<PHINode *> instToMove;
-            std::vector<Instruction *> newInstructions;
-            std::vector<Value *> valueToReplace;
-            llvm::ValueToValueMapTy vmap;
-            for (auto &phi : header->phis())
+            switch (I->getOpcode())
             {
-                instToMove.push_back(dyn_cast<PHINode>(&phi));
+            case Instruction::SDiv:
+            case Instruction::UDiv:
+            case Instruction::SRem:
+            case Instruction::URem:
+            case Instruction::FDiv:
+            case Instruction::FRem:
+            case Instruction::Call:
+                return 20;
+            case Instruction::Mul:
+            case Instruction::FMul:
+            case Instruction::Load:
+                return 4;
+            default:
+                return 1;
             }
-            for (auto i : instToMove)
-            {
+        }
 
-                auto *newInst = dyn_cast<PHINode>(i->clone());
-                newInst->setIncomingBlock(0, testBlock);
-                newInst->setName("phi-" + i->getName());
-                newInst->setIncomingBlock(1, header);
-                newInst->insertBefore(&(L->getExitBlock()->front()));
-                newInstructions.push_back(newInst);
-                vmap[i] = newInst;
+        // Largest number of values live at any point of the loop
+        unsigned getLoopPressure(Loop *L, LivenessDataFlow &ldf)
+        {
+            unsigned pressure = 0;
+            for (auto BB : L->blocks())
+            {
+                BitVector live = ldf.OutBB[BB];
+                pressure = std::max(pressure, (unsigned)live.count());
+                for (auto inst = BB->rbegin(); inst != BB->rend(); ++inst)
+                {
+                    ldf.transferInst(*inst, live);
+                    pressure = std::max(pressure, (unsigned)live.count());
+                }
+            }
+            return pressure;
+        }
 
-                valueToReplace.push_back(i);
+        /**
+         * @brief Change in the number of values live across the loop if the instructions in hoisted are moved out.
+         * A hoisted value that is still used in the loop is live in the whole loop. A value from outside the loop
+         * is no longer live in the loop once all its users in the loop are hoisted
+         *
+         */
+        int getPressureIncrease(Loop *L, DenseSet<Instruction *> &hoisted)
+        {
+            int increase = 0;
+            DenseSet<Value *> outsideOperands;
+            for (auto I : hoisted)
+            {
+                for (auto user : I->users())
+                {
+                    auto userInst = dyn_cast<Instruction>(user);
+                    if (userInst != nullptr && L->contains(userInst) && hoisted.count(userInst) == 0)
+                    {
+                        ++increase;
+                        break;
+                    }
+                }
+                for (auto &op : I->operands())
+                {
+                    if ((isa<Instruction>(op.get()) && !L->contains(dyn_cast<Instruction>(op.get()))) ||
+                        isa<Argument>(op.get()))
+                    {
+                        outsideOperands.insert(op.get());
+                    }
+                }
+            }
 
-                i->moveBefore(&body->front());
-                i->setIncomingBlock(0, landingpad);
-                i->setIncomingBlock(1, header);
+            for (auto V : outsideOperands)
+            {
+                bool usedInLoop = false;
+                for (auto user : V->users())
+                {
+                    auto userInst = dyn_cast<Instruction>(user);
+                    if (userInst != nullptr && L->contains(userInst) && hoisted.count(userInst) == 0)
+                    {
+                        usedInLoop = true;
+                        break;
+                    }
+                }
+                if (!usedInLoop)
+                {
+                    --increase;
+                }
             }
+            return increase;
+        }
 
-            for (auto *i : newInstructions)
+        /**
+         * @brief Chooses the invariants to hoist without raising the register pressure of the loop above MaxPressureLICM.
+         * The pressure is estimated from the live values of the Liveness DFA. Invariants are tried from the most to the
+         * least expensive, each together with the invariants it uses from the loop, and a group is only hoisted if the
+         * pressure stays within the threshold or does not grow
+         *
+         */
+        DenseSet<Instruction *> selectHoists(Loop *L, SmallVectorImpl<Instruction *> &movable)
+        {
+            DenseSet<Instruction *> selected;
+            auto F = L->getHeader()->getParent();
+            LivenessDataFlow ldf(*F);
+            if (MaxPressureLICM == 0 || ldf.isTooLarge())
             {
-                llvm::RemapInstruction(i, vmap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+                selected.insert(movable.begin(), movable.end());
+                return selected;
             }
-            for (size_t i = 0; i < newInstructions.size(); i++)
+            ldf.performDFA(*F);
+            int pressure = getLoopPressure(L, ldf);
+
+            DenseSet<Instruction *> movableSet;
+            movableSet.insert(movable.begin(), movable.end());
+            SmallVector<Instruction *, 64> candidates(movable.begin(), movable.end());
+            std::stable_sort(candidates.begin(), candidates.end(), [&](Instruction *A, Instruction *B) {
+                return getHoistBenefit(A) > getHoistBenefit(B);
+            });
+
+            int currentIncrease = 0;
+            unsigned skipped = 0;
+            for (auto I : candidates)
             {
-                Value *v = valueToReplace[i];
+                if (selected.count(I) != 0)
+                {
+                    continue;
+                }
 
-                for (auto user : v->users())
+                // The invariants of the loop that I uses have to be hoisted with it
+                DenseSet<Instruction *> trial = selected;
+                SmallVector<Instruction *, 8> workList;
+                trial.insert(I);
+                workList.push_back(I);
+                bool canHoist = true;
+                while (!workList.empty() && canHoist)
                 {
-                    if (auto I = dyn_cast<Instruction>(user))
+                    auto inst = workList.pop_back_val();
+                    for (auto &op : inst->operands())
                     {
-                        if (std::find(L->blocks().begin(), L->blocks().end(), I->getParent()) == L->blocks().end())
+                        auto opInst = dyn_cast<Instruction>(op.get());
+                        if (opInst == nullptr || !L->contains(opInst) || trial.count(opInst) != 0)
                         {
-                            for (int opNum = 0; opNum < I->getNumOperands(); ++opNum)
-                            {
-                                if (v == I->getOperand(opNum))
-                                {
-                                    I->setOperand(opNum, newInstructions[i]);
-                                }
-                            }
+                            continue;
                         }
+                        if (movableSet.count(opInst) == 0)
+                        {
+                            canHoist = false;
+                            break;
+                        }
+                        trial.insert(opInst);
+                        workList.push_back(opInst);
                     }
                 }
+                if (!canHoist)
+                {
+                    continue;
+                }
+
+                int increase = getPressureIncrease(L, trial);
+                if (pressure + increase <= (int)MaxPressureLICM || increase <= currentIncrease)
+                {
+                    selected = trial;
+                    currentIncrease = increase;
+                }
+                else
+                {
+                    ++skipped;
+                }
+            }
+
+            if (skipped > 0)
+            {
+                outs() << "Loop pressure " << pressure << ", " << skipped << " invariants left in the loop\n";
             }
+            return selected;
         }
 
-        virtual bool runOnLoop(Loop *L, LPPassManager &LPM) override
+        /**
+         * @brief Loop nest LICM. The whole nest is processed once, from its outermost loop.
+         * Instructions are visited in reverse post order, so operands are placed before their users.
+         * Every instruction is moved straight to the preheader of the outermost loop it is invariant in,
+         * instead of being hoisted one level per loop. The dominators are only computed once for the function
+         *
+         */
+        bool runOnLoopNest(Loop *L)
         {
+            outs() << "Performing Loop Nest Invariant Code Motion\n";
 
-            outs() << "Performing Loop Invariant Code Motion\n";
-            bool changed = true;
+            auto &purity = getAnalysis<PurityPass>();
+            auto &dominators = getAnalysis<DominatorsPass>();
+
+            // Innermost loop of every block, and whether each loop writes memory
+            DenseMap<BasicBlock *, Loop *> innermostLoop;
+            DenseMap<Loop *, bool> loopWritesMemory;
+            for (auto loop : L->getLoopsInPreorder())
+            {
+                loopWritesMemory[loop] = false;
+                for (auto BB : loop->blocks())
+                {
+                    innermostLoop[BB] = loop;
+                    for (auto &I : *BB)
+                    {
+                        loopWritesMemory[loop] |= I.mayWriteToMemory();
+                    }
+                }
+            }
+
+            // The loop the instruction is in after hoisting, nullptr if it is outside the nest
+            DenseMap<Instruction *, Loop *> position;
+            auto getPosition = [&](Value *V) -> Loop * {
+                auto I = dyn_cast<Instruction>(V);
+                if (I == nullptr || !L->contains(I))
+                {
+                    return nullptr;
+                }
+                auto pos = position.find(I);
+                return (pos != position.end()) ? pos->second : innermostLoop[I->getParent()];
+            };
 
-            int numInv = 0;
+            std::vector<std::pair<Instruction *, Loop *>> hoists;
 
-            while (changed)
+            ReversePostOrderTraversal<Function *> rpot(L->getHeader()->getParent());
+            for (auto BB : rpot)
             {
-                int oldNum = numInv;
+                if (!L->contains(BB))
+                {
+                    continue;
+                }
+
+                // Loops containing BB, outermost first
+                SmallVector<Loop *, 4> loopChain;
+                for (auto loop = innermostLoop[BB]; loop != nullptr; loop = loop->getParentLoop())
+                {
+                    loopChain.insert(loopChain.begin(), loop);
+                }
 
-                for (auto BB : L->blocks())
+                for (auto &I : *BB)
                 {
+                    position[&I] = innermostLoop[BB];
 
-                    for (auto &I : *BB)
+                    for (auto loop : loopChain)
                     {
-                        bool isInv = true;
-                        if (!isAssignmentInstruction(I) || isa<PHINode>(&I))
+                        if (!isCodeMotionCandidate(I, purity, loopWritesMemory[loop]) ||
+                            loop->getLoopPreheader() == nullptr || !dominatesExits(BB, loop, dominators))
                         {
                             continue;
                         }
 
+                        bool isInv = true;
                         for (auto &op : I.operands())
                         {
-
-                            auto operand = op.get();
-                            if (!(isDefOutsideLoop(operand, L) || isa<Constant>(operand) || isInvariant(dyn_cast<Value>(operand))))
+                            auto opPosition = getPosition(op.get());
+                            if (opPosition != nullptr && loop->contains(opPosition))
                             {
                                 isInv = false;
                             }
                         }
 
-                        if (isInv && (std::find(invariants.begin(), invariants.end(), dyn_cast<Value>(&I)) == invariants.end()))
+                        if (isInv)
                         {
-                            numInv++;
-                            invariants.push_back(dyn_cast<Value>(&I));
+                            // The preheader belongs to the parent loop
+                            position[&I] = loop->getParentLoop();
+                            hoists.push_back(std::make_pair(&I, loop));
+                            break;
                         }
                     }
                 }
+            }
 
-                if (oldNum == numInv)
-                {
-
-                    changed = false;
-                }
+            for (auto &hoist : hoists)
+            {
+                hoist.first->moveBefore(hoist.second->getLoopPreheader()->getTerminator());
             }
 
-            // We check if loop is while or do-while,
-            // do-while loops do not require a landing pad
+            outs() << "Hoisted " << hoists.size() << " instructions out of the loop nest\n";
 
-            if (dyn_cast<BranchInst>(L->getLoopLatch()->getTerminator())->isConditional())
-            {
-                outs() << "We have a do-while loop\n";
+            return !hoists.empty();
+        }
 
-                auto doms = getAnalysis<DominatorsPass>().getDominators();
-                auto exitDom = doms[L->getExitBlock()];
-                for (auto inv : invariants)
+        virtual bool runOnLoop(Loop *L, LPPassManager &LPM) override
+        {
+            auto &purity = getAnalysis<PurityPass>();
+
+            // Invariants are moved to the preheader, so every loop needs one
+            bool changed = false;
+            if (L->getLoopPreheader() == nullptr)
+            {
+                if (insertPreheader(L, getAnalysis<LoopInfoWrapperPass>().getLoopInfo()) == nullptr)
                 {
-                    auto invariant = dyn_cast<Instruction>(inv);
-                    if (std::find(exitDom.begin(), exitDom.end(), invariant->getParent()) != exitDom.end())
-                    {
-                        invariant->moveBefore(L->getLoopPreheader()->getTerminator());
-                    }
+                    return false;
                 }
+                changed = true;
+            }
 
-                return true;
+            // Inner loops are visited first, so a location promoted in an inner loop
+            // is promoted again in its parent through the new loads and stores
+            if (PromoteLICM)
+            {
+                changed |= promoteScalars(L, purity);
             }
 
-            preheader = L->getLoopPreheader();
-            BasicBlock *body = nullptr;
-            for (auto succ : successors(L->getHeader()))
+            bool loopWritesMemory = false;
+            for (auto BB : L->blocks())
             {
-                if (succ != L->getExitBlock())
+                for (auto &I : *BB)
                 {
-                    body = succ;
+                    loopWritesMemory |= I.mayWriteToMemory();
                 }
             }
 
-            testBlock = SplitEdge(preheader, L->getHeader(), nullptr, nullptr, nullptr);
-            testBlock->setName("test");
-            landingpad = SplitEdge(testBlock, L->getHeader());
-            landingpad->setName("landing-pad");
-
-            // Code Motion Candidates
-
-            getTestCondition(L);
-            movePhisToBodyAndExit(L, body);
-
-            L->moveToHeader(body);
-            LoopInfo LI;
-            if (auto parentLoop = L->getParentLoop())
+            // Instructions sunk out of an inner loop can be sunk again out of its parent
+            if (SinkLICM)
             {
-                parentLoop->addBasicBlockToLoop(testBlock, LI);
-                parentLoop->addBasicBlockToLoop(landingpad, LI);
+                changed |= sinkToExits(L, purity, loopWritesMemory);
             }
 
-            dyn_cast<BranchInst>(landingpad->getTerminator())->setSuccessor(0, body);
-            auto dominators = getAnalysis<DominatorsPass>().getDominators();
+            if (NestLICM)
+            {
+                // Inner loops are handled together with their outermost loop
+                if (L->getParentLoop() != nullptr)
+                {
+                    return changed;
+                }
+                return runOnLoopNest(L) || changed;
+            }
 
-            SmallVector<BasicBlock *, 64> loopExitBlocks;
+            outs() << "Performing Loop Invariant Code Motion\n";
 
-            auto dfa = new DominatorsDFA(*testBlock->getParent());
-            dfa->performDFA(*testBlock->getParent());
+            // The pass object is reused for every loop
+            invariants.clear();
+            invariantSet.clear();
+            findInvariants(L, purity, loopWritesMemory);
 
-            L->getExitingBlocks(loopExitBlocks);
+            // While loops are rotated, so that their body is executed whenever the loop is entered.
+            // Do-while loops do not require a landing pad
+            auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+            auto &dominators = getAnalysis<DominatorsPass>();
+            DenseMap<Value *, SmallVector<PHINode *, 8>> rotationPhis;
 
-            // After Landing Pad insertion
+            BasicBlock *body = getRotationBody(L);
+            if (body == nullptr)
+            {
+                outs() << "We have a do-while loop\n";
+                landingpad = L->getLoopPreheader();
+            }
+            else
+            {
+                auto header = L->getHeader();
+                testBlock = SplitEdge(L->getLoopPreheader(), header, nullptr, &LI, nullptr);
+                testBlock->setName("test");
+                dominators.insertBlock(testBlock, header);
+                landingpad = SplitEdge(testBlock, header, nullptr, &LI, nullptr);
+                landingpad->setName("landing-pad");
+                dominators.insertBlock(landingpad, header);
 
-            std::vector<PHINode *> removablePhis;
+                ValueToValueMapTy vmap;
+                getTestCondition(L, vmap);
+                movePhisToBodyAndExit(L, body, vmap, rotationPhis);
+                L->moveToHeader(body);
+            }
 
-            // Check for Code Motion candidates
+            // Invariants are moved if they are executed whenever the loop is left
+            SmallVector<Instruction *, 64> movable;
             for (auto invariant : invariants)
             {
-                bool canMove = true;
-                if (isa<PHINode>(invariant))
-                {
-                    canMove = false;
-                }
-                for (auto loopExitBlock : loopExitBlocks)
+                auto I = dyn_cast<Instruction>(invariant);
+                if (dominatesExits(I->getParent(), L, dominators))
                 {
-                    auto exitDom = dfa->getDomList(loopExitBlock);
-
-                    if (std::find(exitDom.begin(), exitDom.end(), dyn_cast<Instruction>(invariant)->getParent()) == exitDom.end())
-                        canMove = false;
+                    movable.push_back(I);
                 }
+            }
+            auto selected = selectHoists(L, movable);
 
-                if (canMove)
+            unsigned hoisted = 0;
+            for (auto invariant : invariants)
+            {
+                auto I = dyn_cast<Instruction>(invariant);
+                if (selected.count(I) == 0)
                 {
+                    continue;
+                }
 
-                    dyn_cast<Instruction>(invariant)->moveBefore(landingpad->getTerminator());
+                I->moveBefore(landingpad->getTerminator());
+                ++hoisted;
 
-                    //  If any phi function in body used this value, replace its uses with this value
-                    for (auto &phi : body->phis())
+                // PHIs in the loop that merged a hoisted header value with its copy in the guard are not needed
+                auto phis = rotationPhis.find(I);
+                if (phis != rotationPhis.end())
+                {
+                    for (auto phi : phis->second)
                     {
-                        bool removePhi = false;
-
-                        for (auto &val : phi.incoming_values())
-                        {
-                            if (val.get() == invariant)
-                            {
-                                removePhi = true;
-                            }
-                        }
-                        if (removePhi)
+                        if (L->contains(phi))
                         {
-                            phi.replaceAllUsesWith(invariant);
-                            removablePhis.push_back(&phi);
+                            phi->replaceAllUsesWith(I);
+                            phi->eraseFromParent();
                         }
                     }
                 }
             }
 
-            for (auto phi : removablePhis)
+            // Invariant conditions are only tested once the invariants are hoisted
+            if (UnswitchLICM)
             {
-                phi->eraseFromParent();
+                changed |= unswitchLoop(L);
             }
 
-            return true;
+            return changed || body != nullptr || hoisted > 0;
         }
 
         virtual void getAnalysisUsage(AnalysisUsage &Info) const override
         {
+            Info.addRequired<LoopInfoWrapperPass>();
             Info.addRequired<DominatorsPass>();
+            Info.addPreserved<DominatorsPass>();
+            Info.addRequired<PurityPass>();
         };
     };
     char LICMPass::ID = 0;
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+
+#include "purity.h"
+
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm
+{
+
+    // Memory of an alloca of the function itself is not visible to the caller
+    static bool isLocalMemory(Value *pointer, Function *F)
+    {
+        pointer = pointer->stripPointerCasts();
+        while (auto gep = dyn_cast<GEPOperator>(pointer))
+        {
+            pointer = gep->getPointerOperand()->stripPointerCasts();
+        }
+        auto alloca = dyn_cast<AllocaInst>(pointer);
+        return alloca != nullptr && alloca->getFunction() == F;
+    }
+
+    static FunctionPurity getAttributePurity(CallBase *call)
+    {
+        FunctionPurity callPurity;
+        callPurity.readNone = call->doesNotAccessMemory();
+        callPurity.readOnly = call->onlyReadsMemory();
+        callPurity.noUnwind = call->doesNotThrow();
+        callPurity.willReturn = call->hasFnAttr(Attribute::WillReturn);
+        return callPurity;
+    }
+
+    FunctionPurity PurityPass::getCallPurity(CallBase *call)
+    {
+        auto callee = call->getCalledFunction();
+        if (callee != nullptr && purity.find(callee) != purity.end())
+        {
+            return purity[callee];
+        }
+        return getAttributePurity(call);
+    }
+
+    bool PurityPass::isRemovableCall(Instruction *I)
+    {
+        auto call = dyn_cast<CallBase>(I);
+        if (call == nullptr || isa<InvokeInst>(call))
+        {
+            return false;
+        }
+        auto callPurity = getCallPurity(call);
+        return callPurity.readOnly && callPurity.noUnwind && callPurity.willReturn;
+    }
+
+    bool PurityPass::isHoistableCall(Instruction *I, bool loopWritesMemory)
+    {
+        if (!isRemovableCall(I))
+        {
+            return false;
+        }
+        auto callPurity = getCallPurity(dyn_cast<CallBase>(I));
+        return callPurity.readNone || !loopWritesMemory;
+    }
+
+    bool PurityPass::runOnModule(Module &M)
+    {
+        CallGraph cg = CallGraph(M);
+
+        for (auto sccItr = scc_begin(&cg); !sccItr.isAtEnd(); ++sccItr)
+        {
+            const std::vector<CallGraphNode *> &scc = *sccItr;
+
+            std::vector<Function *> sccFunctions;
+            for (auto node : scc)
+            {
+                // A body that may be replaced at link time (weak, linkonce) says nothing about the one that runs
+                if (node->getFunction() != nullptr && node->getFunction()->hasExactDefinition())
+                {
+                    sccFunctions.push_back(node->getFunction());
+                }
+            }
+            if (sccFunctions.empty())
+            {
+                continue;
+            }
+
+            // Calls within the SCC are assumed pure, but they may recurse forever
+            FunctionPurity sccPurity;
+            sccPurity.willReturn = !sccItr.hasCycle();
+
+            for (auto F : sccFunctions)
+            {
+                for (auto &BB : *F)
+                {
+                    for (auto &I : BB)
+                    {
+                        if (auto call = dyn_cast<CallBase>(&I))
+                        {
+                            if (std::find(sccFunctions.begin(), sccFunctions.end(), call->getCalledFunction()) !=
+                                sccFunctions.end())
+                            {
+                                continue;
+                            }
+                            auto callPurity = getCallPurity(call);
+                            sccPurity.readNone &= callPurity.readNone;
+                            sccPurity.readOnly &= callPurity.readOnly;
+                            sccPurity.noUnwind &= callPurity.noUnwind;
+                            sccPurity.willReturn &= callPurity.willReturn;
+                            continue;
+                        }
+
+                        if (auto load = dyn_cast<LoadInst>(&I))
+                        {
+                            if (load->isSimple() && isLocalMemory(load->getPointerOperand(), F))
+                            {
+                                continue;
+                            }
+                        }
+                        if (auto store = dyn_cast<StoreInst>(&I))
+                        {
+                            if (store->isSimple() && isLocalMemory(store->getPointerOperand(), F))
+                            {
+                                continue;
+                            }
+                        }
+
+                        if (I.mayWriteToMemory())
+                        {
+                            sccPurity.readNone = false;
+                            sccPurity.readOnly = false;
+                        }
+                        if (I.mayReadFromMemory())
+                        {
+                            sccPurity.readNone = false;
+                        }
+                        if (I.mayThrow())
+                        {
+                            sccPurity.noUnwind = false;
+                        }
+                    }
+                }
+
+                // A loop may never terminate
+                for (auto cfgSccItr = scc_begin(F); !cfgSccItr.isAtEnd(); ++cfgSccItr)
+                {
+                    if (cfgSccItr.hasCycle())
+                    {
+                        sccPurity.willReturn = false;
+                    }
+                }
+            }
+
+            for (auto F : sccFunctions)
+            {
+                purity[F] = sccPurity;
+            }
+        }
+
+        return false;
+    }
+
+    void PurityPass::print(raw_ostream &O, const Module *M) const
+    {
+        for (auto &functionPurity : purity)
+        {
+            auto &p = functionPurity.second;
+            O << functionPurity.first->getName() << " : " << (p.readNone ? "readnone " : (p.readOnly ? "readonly " : ""))
+              << (p.noUnwind ? "nounwind " : "") << (p.willReturn ? "willreturn" : "") << "\n";
+        }
+    }
+
+    char PurityPass::ID = 0;
+    RegisterPass<PurityPass> P("purity", "Function Purity Inference", false, true);
+}
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __PURITY_H__
+#define __PURITY_H__
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+
+namespace llvm
+{
+
+    /**
+     * @brief The effects a function (or a call) may have
+     *
+     */
+    struct FunctionPurity
+    {
+        // Does not read or write memory that is visible to the caller
+        bool readNone = true;
+        // Does not write memory that is visible to the caller
+        bool readOnly = true;
+        bool noUnwind = true;
+        // Always returns to the caller (no infinite loops or recursion)
+        bool willReturn = true;
+    };
+
+    /**
+     * @brief Bottom up purity inference over the Call Graph.
+     * Strongly connected components are visited callees first, so the purity of every callee
+     * is known when a caller is inspected. Functions in the same SCC share their purity.
+     *
+     */
+    class PurityPass : public ModulePass
+    {
+    public:
+        static char ID;
+        DenseMap<const Function *, FunctionPurity> purity;
+
+        PurityPass() : ModulePass(ID){};
+
+        bool runOnModule(Module &M) override;
+
+        /**
+         * @brief Get the purity of a call, from the inferred purity of the callee if there is one,
+         * and from the attributes of the call otherwise
+         */
+        FunctionPurity getCallPurity(CallBase *call);
+
+        /**
+         * @brief A call can be removed if its result is unused, it does not write memory, does not throw
+         * and always returns
+         */
+        bool isRemovableCall(Instruction *I);
+
+        /**
+         * @brief A call with invariant arguments can be hoisted out of a loop if it is removable and either
+         * reads no memory, or only reads memory while nothing in the loop writes memory
+         */
+        bool isHoistableCall(Instruction *I, bool loopWritesMemory);
+
+        void print(raw_ostream &O, const Module *M) const override;
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override
+        {
+            AU.setPreservesAll();
+        }
+    };
+}
+
+#endif
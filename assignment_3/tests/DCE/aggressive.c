@@ -0,0 +1,17 @@
+int aggressive(int n)
+{
+    int sum = 0;
+    int unused = 7;
+    for (int i = 0; i < n; i++)
+    {
+        // unused only feeds itself around the loop, so it is never marked live
+        unused = unused * 3 + i;
+        sum += i;
+    }
+    return sum;
+}
+
+int main()
+{
+    return aggressive(10);
+}
@@ -0,0 +1,19 @@
+int scale(int x)
+{
+    return x * 3;
+}
+
+int cascade(int x, int y)
+{
+    // The call is removed since scale has no side effects, which leaves its argument t dead,
+    // and then the operand u of t
+    int u = y + 1;
+    int t = x * u;
+    scale(t);
+    return x;
+}
+
+int main()
+{
+    return cascade(2, 5);
+}
@@ -0,0 +1,23 @@
+int control(int n)
+{
+    int sum = 0;
+    int unused = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sum += i;
+        if (i % 3 == 0)
+        {
+            unused += i * 2;
+        }
+        else
+        {
+            unused -= 1;
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    return control(argc);
+}
@@ -0,0 +1,27 @@
+int faint(int x, int k)
+{
+    // t is only used to compute u, and u is never used, so both are faint across the blocks
+    int t = x * k;
+    int u = 0;
+    int r;
+    switch (x)
+    {
+    case 0:
+        u = t + 1;
+        r = 1;
+        break;
+    case 1:
+        u = t - 1;
+        r = 2;
+        break;
+    default:
+        r = 3;
+        break;
+    }
+    return r;
+}
+
+int main()
+{
+    return faint(1, 5);
+}
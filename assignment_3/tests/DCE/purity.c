@@ -0,0 +1,27 @@
+int counter;
+
+int square(int x)
+{
+    return x * x;
+}
+
+int bump(int x)
+{
+    counter += x;
+    return counter;
+}
+
+int purity(int x)
+{
+    // square has no side effects, so its unused call is removed. bump writes a global and stays,
+    // along with the computation of its argument
+    square(x);
+    bump(x);
+    bump(x + 1);
+    return x;
+}
+
+int main()
+{
+    return purity(3);
+}
@@ -0,0 +1,21 @@
+int test(int *a, int n, int stride)
+{
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        a[i * stride] = i;
+        sum += i * stride * 3;
+    }
+    for (int j = n; j > 0; j--)
+    {
+        sum += j * 7;
+    }
+    return sum;
+}
+
+int main()
+{
+    int a[100];
+    int r = test(a, 10, 9);
+    return r;
+}
@@ -0,0 +1,21 @@
+int find(int *values, int n, int k, int s)
+{
+    // The while loop has two exits, the loop test and the return. It is rotated, and k * s is
+    // hoisted into the landing pad that runs only when the loop is entered
+    int i = 0;
+    while (i < n)
+    {
+        if (values[i] == k * s)
+        {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+int main()
+{
+    int values[4] = {1, 6, 3, 4};
+    return find(values, 4, 2, 3);
+}
@@ -0,0 +1,26 @@
+int nest(int n, int m, int k)
+{
+    int sum = 0;
+    int i = 0;
+    // Nest mode does not rotate loops, so do-while loops are used
+    do
+    {
+        int j = 0;
+        do
+        {
+            // k * 3 is invariant in both loops and goes straight to the preheader of the outer loop,
+            // i * 7 is only invariant in the inner loop
+            int t = k * 3;
+            int u = i * 7;
+            sum += t + u + j;
+            j++;
+        } while (j < m);
+        i++;
+    } while (i < n);
+    return sum;
+}
+
+int main()
+{
+    return nest(10, 20, 4);
+}
@@ -0,0 +1,18 @@
+int pressure(int n, int a, int b, int c, int d)
+{
+    // Every term is invariant, but with a low limit only those that do not make the
+    // loop hold more values at once are hoisted, divisions and multiplications first
+    int sum = 0;
+    int i = 0;
+    do
+    {
+        sum += (a + b) + (c + d) + (a * c) + (b / 7);
+        i++;
+    } while (i < n);
+    return sum;
+}
+
+int main()
+{
+    return pressure(3, 1, 20, 3, 4);
+}
@@ -0,0 +1,20 @@
+int total;
+
+void promote(int n, int k)
+{
+    // No other access in the loop may touch total, so it is loaded once before the loop
+    // and stored back on its exit. The store runs on every iteration of the do-while loop,
+    // so storing on the exit adds no store the program would not have made
+    int i = 0;
+    do
+    {
+        total += i * k;
+        i++;
+    } while (i < n);
+}
+
+int main()
+{
+    promote(10, 3);
+    return total;
+}
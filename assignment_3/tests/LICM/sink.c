@@ -0,0 +1,18 @@
+int sink(int n, int k)
+{
+    int i = 0;
+    int square;
+    // square is only used after the loop, so it is computed once in the exit block.
+    // Sinking is on by default
+    do
+    {
+        square = i * i + k;
+        i++;
+    } while (i < n);
+    return square;
+}
+
+int main()
+{
+    return sink(10, 3);
+}
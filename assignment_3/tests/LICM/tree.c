@@ -0,0 +1,30 @@
+int tree(int n, int m, int mode, int k)
+{
+    // Both loops are rotated and the inner one is unswitched on mode. Each change splits or
+    // clones blocks, and the dominator tree is updated in place instead of being recomputed
+    int sum = 0;
+    int i = 0;
+    while (i < n)
+    {
+        int j = 0;
+        while (j < m)
+        {
+            if (mode != 0)
+            {
+                sum += i * j + k * i;
+            }
+            else
+            {
+                sum -= j;
+            }
+            j++;
+        }
+        i++;
+    }
+    return sum;
+}
+
+int main()
+{
+    return tree(4, 5, 1, 3) + tree(3, 6, 0, 3);
+}
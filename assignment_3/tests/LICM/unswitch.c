@@ -0,0 +1,22 @@
+int unswitch(int n, int mode)
+{
+    // mode == 0 is invariant, so the loop is cloned and the condition is tested once before it
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (mode == 0)
+        {
+            sum += i;
+        }
+        else
+        {
+            sum -= i;
+        }
+    }
+    return sum;
+}
+
+int main()
+{
+    return unswitch(10, 0) + unswitch(5, 1);
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "Dataflow.h"
+#include "Expression.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace llvm
+{
+
+/**
+ * @brief Available Expressions DFA. An expression is available at a point if every
+ * path from the entry computes it and none of its operands are redefined afterwards
+ *
+ */
+class AvailableExpressionDataflow : public Dataflow<Expression>
+{
+
+  public:
+    AvailableExpressionDataflow(Function &F) : Dataflow(FORWARDS)
+    {
+        int i = 0;
+        for (auto &BB : F)
+        {
+
+            if (i == 0)
+            {
+                // This is the first landing block
+                InBB[&BB] = BitVector(256, false);
+            }
+            else
+            {
+                InBB[&BB] = BitVector(256, true);
+            }
+
+            OutBB[&BB] = BitVector(256, true);
+
+            ++i;
+
+            // The domain is collected upfront, so that its size is known before the DFA runs
+            for (auto &inst : BB)
+            {
+                if (isa<BinaryOperator>(&inst) && getExprIdx(Expression(&inst)) == -1)
+                {
+                    getDomain().push_back(Expression(&inst));
+                }
+            }
+        }
+    };
+
+    bool isTooLarge()
+    {
+        return getDomain().size() > 256;
+    }
+
+    /**
+     * @brief This is the transfer function, which calculates the
+     * IN[B] or OUT[B] based on the data flow INSIDE a basic block
+     *
+     */
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector genSet, killSet;
+        std::tie(genSet, killSet) = getGenAndKillSet(BB);
+
+        auto newOut = killSet.flip();
+        newOut &= InBB[&BB];
+        newOut |= genSet;
+        return newOut;
+    };
+
+    std::vector<Expression> getExprFromBitVector(BitVector bv)
+    {
+
+        std::vector<Expression> exprSet;
+        for (auto setBit : bv.set_bits())
+        {
+            exprSet.push_back(getDomain()[setBit]);
+        }
+        return exprSet;
+    }
+
+    /**
+     * @brief Get the index of an expression in the domain
+     *
+     * @return int - The index, or -1 if the expression was never seen by the DFA
+     */
+    int getExprIdx(const Expression &expr)
+    {
+        auto itr = std::find(getDomain().begin(), getDomain().end(), expr);
+        if (itr == getDomain().end())
+        {
+            return -1;
+        }
+        return itr - getDomain().begin();
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool isEntryBB) override
+    {
+        auto predecessorBBs = predecessors(&BB);
+        auto newIn = BitVector(256, true);
+        if (isEntryBB == true)
+        {
+            // This is the first landing block. It has no predecessors. So IN will never be updated
+            newIn.flip();
+        }
+        // Calculating IN[BB] = &(Out[P]) for every predecessor P of BB
+        for (auto predBB : predecessorBBs)
+        {
+            if (isEntryBB == true)
+            {
+                // Even the landing block has a predecessor. We thus flip the bits again
+                newIn.flip();
+            }
+            newIn &= OutBB[predBB];
+        }
+        return newIn;
+    };
+
+    std::pair<BitVector, BitVector> getGenAndKillSet(BasicBlock &BB) override
+    {
+        // Gen And Kill sets need to be computed together
+
+        if ((GenBB.find(&BB) != GenBB.end()) && (KillBB.find(&BB) != KillBB.end()))
+        {
+            return std::pair<BitVector, BitVector>(GenBB[&BB], KillBB[&BB]);
+        }
+
+        BitVector genSet(256, false);
+        BitVector killSet(256, false);
+
+        for (auto &inst : BB)
+        {
+            BinaryOperator *binInst = dyn_cast<BinaryOperator>(&inst);
+            if (binInst != nullptr)
+            {
+                // We have a binary operator
+                auto expr = std::find(getDomain().begin(), getDomain().end(), Expression(binInst));
+
+                if (expr == getDomain().end())
+                {
+                    getDomain().push_back(Expression(binInst));
+                }
+                int exprIdx =
+                    std::find(getDomain().begin(), getDomain().end(), Expression(binInst)) - getDomain().begin();
+
+                // Expression added to GenSet
+
+                genSet.set(exprIdx);
+
+                // Remove expressions from genSet too
+                std::string destName = getShortValueName(binInst);
+                BitVector bv(256, false); // bv represents all the expressions killed by this instruction
+                for (auto ex : getDomain())
+                {
+                    if ((getShortValueName(ex.v1) == destName) || (getShortValueName(ex.v2) == destName))
+                    {
+                        bv.set(std::find(getDomain().begin(), getDomain().end(), ex) - getDomain().begin());
+                    }
+                }
+                // KillSet is just OR of killset for every statement in the BB
+
+                killSet |= bv;
+
+                // Let's get the genset
+                genSet &= (bv.flip());
+            }
+        }
+
+        // Cache the GenSet and KillSet for every Block to use for next iteration
+        GenBB.insert(std::pair<BasicBlock *, BitVector>(&BB, genSet));
+        KillBB.insert(std::pair<BasicBlock *, BitVector>(&BB, killSet));
+
+        return std::pair<BitVector, BitVector>(genSet, killSet);
+    }
+};
+} // namespace llvm
@@ -0,0 +1,422 @@
+#pragma once
+
+#include "Common.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace llvm
+{
+
+/**
+ * @brief The three levels of the constant propagation lattice. A value is UNDEFINED until it is
+ * known to be computed, then CONSTANT, and OVERDEFINED once it may take more than one value
+ *
+ */
+enum LatticeState
+{
+    UNDEFINED,
+    CONSTANT,
+    OVERDEFINED
+};
+
+struct LatticeValue
+{
+    LatticeState state = UNDEFINED;
+    Constant *constant = nullptr;
+};
+
+/**
+ * @brief Sparse conditional constant propagation (Wegman and Zadeck). Values are propagated along the SSA edges,
+ * and only through the CFG edges found to be executable: a conditional branch on a constant only makes the
+ * taken edge executable, and PHIs only merge the values of their executable incoming edges
+ *
+ */
+class ConstantPropagationSolver
+{
+  private:
+    const DataLayout &DL;
+    DenseMap<Value *, LatticeValue> values;
+    DenseSet<BasicBlock *> executableBlocks;
+    DenseSet<std::pair<BasicBlock *, BasicBlock *>> executableEdges;
+
+    SmallVector<BasicBlock *, 32> blockWorkList;
+    SmallVector<Instruction *, 64> instWorkList;
+
+    void markOverdefined(Instruction *I)
+    {
+        auto &lattice = values[I];
+        if (lattice.state != OVERDEFINED)
+        {
+            lattice.state = OVERDEFINED;
+            lattice.constant = nullptr;
+            pushUsers(I);
+        }
+    }
+
+    void markConstant(Instruction *I, Constant *C)
+    {
+        auto &lattice = values[I];
+        if (lattice.state == UNDEFINED)
+        {
+            lattice.state = CONSTANT;
+            lattice.constant = C;
+            pushUsers(I);
+        }
+        else if (lattice.state == CONSTANT && lattice.constant != C)
+        {
+            markOverdefined(I);
+        }
+    }
+
+    void pushUsers(Instruction *I)
+    {
+        for (auto user : I->users())
+        {
+            auto userInst = dyn_cast<Instruction>(user);
+            if (userInst != nullptr && isBlockExecutable(userInst->getParent()))
+            {
+                instWorkList.push_back(userInst);
+            }
+        }
+    }
+
+    void markEdgeExecutable(BasicBlock *from, BasicBlock *to)
+    {
+        if (!executableEdges.insert(std::make_pair(from, to)).second)
+        {
+            return;
+        }
+        if (executableBlocks.insert(to).second)
+        {
+            blockWorkList.push_back(to);
+        }
+        else
+        {
+            // The PHIs of an executable block have a new incoming value to merge
+            for (auto &phi : to->phis())
+            {
+                instWorkList.push_back(&phi);
+            }
+        }
+    }
+
+    void visitPHI(PHINode &phi)
+    {
+        Constant *merged = nullptr;
+        for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i)
+        {
+            if (!isEdgeExecutable(phi.getIncomingBlock(i), phi.getParent()))
+            {
+                continue;
+            }
+            auto incoming = getLatticeValue(phi.getIncomingValue(i));
+            if (incoming.state == OVERDEFINED || (merged != nullptr && incoming.state == CONSTANT && incoming.constant != merged))
+            {
+                markOverdefined(&phi);
+                return;
+            }
+            if (incoming.state == CONSTANT)
+            {
+                merged = incoming.constant;
+            }
+        }
+        if (merged != nullptr)
+        {
+            markConstant(&phi, merged);
+        }
+    }
+
+    void visitTerminator(Instruction &term)
+    {
+        auto BB = term.getParent();
+        if (auto branch = dyn_cast<BranchInst>(&term))
+        {
+            if (branch->isConditional())
+            {
+                auto cond = getLatticeValue(branch->getCondition());
+                if (cond.state == UNDEFINED)
+                {
+                    return;
+                }
+                auto constCond = dyn_cast_or_null<ConstantInt>(cond.constant);
+                if (cond.state == CONSTANT && constCond != nullptr)
+                {
+                    markEdgeExecutable(BB, branch->getSuccessor(constCond->isZero() ? 1 : 0));
+                    return;
+                }
+            }
+        }
+        else if (auto switchInst = dyn_cast<SwitchInst>(&term))
+        {
+            auto cond = getLatticeValue(switchInst->getCondition());
+            if (cond.state == UNDEFINED)
+            {
+                return;
+            }
+            auto constCond = dyn_cast_or_null<ConstantInt>(cond.constant);
+            if (cond.state == CONSTANT && constCond != nullptr)
+            {
+                markEdgeExecutable(BB, switchInst->findCaseValue(constCond)->getCaseSuccessor());
+                return;
+            }
+        }
+
+        for (auto succ : successors(BB))
+        {
+            markEdgeExecutable(BB, succ);
+        }
+    }
+
+    // Folds the instruction once all its operands are known. Only instructions computing a value from their
+    // operands are folded, any other instruction (loads, calls, ...) is overdefined
+    void visitInst(Instruction &I)
+    {
+        if (auto phi = dyn_cast<PHINode>(&I))
+        {
+            visitPHI(*phi);
+            return;
+        }
+        if (I.isTerminator())
+        {
+            // The value of an invoke (or callbr) is not known, it is computed by the callee
+            visitTerminator(I);
+            if (!I.getType()->isVoidTy())
+            {
+                markOverdefined(&I);
+            }
+            return;
+        }
+        if (values[&I].state == OVERDEFINED)
+        {
+            return;
+        }
+        if (!isa<BinaryOperator>(&I) && !isa<CmpInst>(&I) && !isa<CastInst>(&I) && !isa<SelectInst>(&I))
+        {
+            markOverdefined(&I);
+            return;
+        }
+
+        if (auto select = dyn_cast<SelectInst>(&I))
+        {
+            auto cond = getLatticeValue(select->getCondition());
+            if (cond.state == CONSTANT && isa<ConstantInt>(cond.constant))
+            {
+                auto chosen = getLatticeValue(dyn_cast<ConstantInt>(cond.constant)->isZero() ? select->getFalseValue()
+                                                                                             : select->getTrueValue());
+                if (chosen.state == CONSTANT)
+                {
+                    markConstant(&I, chosen.constant);
+                }
+                else if (chosen.state == OVERDEFINED)
+                {
+                    markOverdefined(&I);
+                }
+                return;
+            }
+        }
+
+        SmallVector<Constant *, 4> operands;
+        for (auto &op : I.operands())
+        {
+            auto lattice = getLatticeValue(op.get());
+            if (lattice.state == OVERDEFINED)
+            {
+                markOverdefined(&I);
+                return;
+            }
+            if (lattice.state == UNDEFINED)
+            {
+                return;
+            }
+            operands.push_back(lattice.constant);
+        }
+
+        Constant *folded = nullptr;
+        if (auto cmp = dyn_cast<CmpInst>(&I))
+        {
+            folded = ConstantFoldCompareInstOperands(cmp->getPredicate(), operands[0], operands[1], DL);
+        }
+        else
+        {
+            folded = ConstantFoldInstOperands(&I, operands, DL);
+        }
+
+        // Constant expressions (e.g on the address of a global) are not simpler than the instruction
+        if (folded == nullptr || isa<ConstantExpr>(folded))
+        {
+            markOverdefined(&I);
+            return;
+        }
+        markConstant(&I, folded);
+    }
+
+  public:
+    ConstantPropagationSolver(Function &F) : DL(F.getParent()->getDataLayout())
+    {
+    }
+
+    LatticeValue getLatticeValue(Value *V)
+    {
+        LatticeValue lattice;
+        // An undef operand is folded as any other constant, it is never computed so it would stay UNDEFINED
+        if (auto C = dyn_cast<Constant>(V))
+        {
+            lattice.state = CONSTANT;
+            lattice.constant = C;
+            return lattice;
+        }
+        if (auto I = dyn_cast<Instruction>(V))
+        {
+            return values.lookup(I);
+        }
+        // Arguments
+        lattice.state = OVERDEFINED;
+        return lattice;
+    }
+
+    bool isBlockExecutable(BasicBlock *BB)
+    {
+        return executableBlocks.count(BB) != 0;
+    }
+
+    bool isEdgeExecutable(BasicBlock *from, BasicBlock *to)
+    {
+        return executableEdges.count(std::make_pair(from, to)) != 0;
+    }
+
+    /**
+     * @brief Get the constant an instruction always evaluates to, nullptr if it is not a constant
+     */
+    Constant *getConstant(Instruction *I)
+    {
+        auto lattice = values.lookup(I);
+        return (lattice.state == CONSTANT) ? lattice.constant : nullptr;
+    }
+
+    void solve(Function &F)
+    {
+        executableBlocks.insert(&F.getEntryBlock());
+        blockWorkList.push_back(&F.getEntryBlock());
+
+        while (!blockWorkList.empty() || !instWorkList.empty())
+        {
+            while (!instWorkList.empty())
+            {
+                visitInst(*instWorkList.pop_back_val());
+            }
+            while (!blockWorkList.empty())
+            {
+                for (auto &I : *blockWorkList.pop_back_val())
+                {
+                    visitInst(I);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Get the instructions of the executable blocks that always evaluate to a constant, with their constant.
+     * They are collected before foldBranches changes the CFG
+     */
+    std::vector<std::pair<Instruction *, Constant *>> getConstantInsts(Function &F)
+    {
+        std::vector<std::pair<Instruction *, Constant *>> constantInsts;
+        for (auto &BB : F)
+        {
+            if (!isBlockExecutable(&BB))
+            {
+                continue;
+            }
+            for (auto &I : BB)
+            {
+                if (auto C = getConstant(&I))
+                {
+                    constantInsts.push_back(std::make_pair(&I, C));
+                }
+            }
+        }
+        return constantInsts;
+    }
+
+    /**
+     * @brief Makes the branches with a single executable successor unconditional and deletes the blocks
+     * that are no longer reachable
+     *
+     * @return The number of branches folded and of blocks deleted
+     */
+    std::pair<unsigned, unsigned> foldBranches(Function &F)
+    {
+        unsigned numBranches = 0;
+        for (auto &BB : F)
+        {
+            auto term = BB.getTerminator();
+            if (!isBlockExecutable(&BB) || (!isa<BranchInst>(term) && !isa<SwitchInst>(term)) || term->getNumSuccessors() < 2)
+            {
+                continue;
+            }
+
+            BasicBlock *taken = nullptr;
+            bool single = true;
+            for (auto succ : successors(&BB))
+            {
+                if (isEdgeExecutable(&BB, succ))
+                {
+                    single &= (taken == nullptr || taken == succ);
+                    taken = succ;
+                }
+            }
+            if (taken == nullptr || !single)
+            {
+                continue;
+            }
+
+            // The PHIs of a dead successor have one incoming value per edge, e.g for the cases of a switch
+            for (auto succ : successors(&BB))
+            {
+                if (succ != taken)
+                {
+                    succ->removePredecessor(&BB, true);
+                }
+            }
+            // A successor reached through several edges keeps the incoming values of a single one
+            unsigned numEdges = std::count(succ_begin(&BB), succ_end(&BB), taken);
+            for (auto &phi : taken->phis())
+            {
+                for (unsigned i = 1; i < numEdges; ++i)
+                {
+                    phi.removeIncomingValue(&BB, false);
+                }
+            }
+            BranchInst::Create(taken, term);
+            term->eraseFromParent();
+            ++numBranches;
+        }
+
+        SmallPtrSet<BasicBlock *, 32> reachable;
+        for (auto BB : depth_first(&F.getEntryBlock()))
+        {
+            reachable.insert(BB);
+        }
+        SmallVector<BasicBlock *, 16> deadBlocks;
+        for (auto &BB : F)
+        {
+            if (reachable.count(&BB) == 0)
+            {
+                deadBlocks.push_back(&BB);
+            }
+        }
+        // PHIs left with a single input are kept, so that no instruction of an executable block is erased
+        DeleteDeadBlocks(deadBlocks, nullptr, true);
+
+        return std::make_pair(numBranches, deadBlocks.size());
+    }
+};
+
+} // namespace llvm
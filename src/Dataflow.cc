@@ -1,7 +1,7 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
-#include "dataflow.h"
+#include "Dataflow.h"
 
 namespace llvm
 {
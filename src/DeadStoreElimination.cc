@@ -0,0 +1,295 @@
+#include "Dataflow.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+
+/**
+ * @brief Liveness of memory locations. A location is live at a point if it may be read
+ * before it is overwritten. Only locations that are accessed with plain loads and stores
+ * of the location itself are tracked, so two accesses alias exactly when their pointers are equal
+ *
+ */
+class MemoryLivenessDataflow : public Dataflow<Value *>
+{
+  private:
+    // Globals may be read by any call and after the function returns
+    BitVector globalLocations;
+
+  public:
+    MemoryLivenessDataflow(Function &F) : Dataflow(BACKWARDS), globalLocations(256, false)
+    {
+        for (auto &BB : F)
+        {
+            for (auto &I : BB)
+            {
+                if (auto alloca = dyn_cast<AllocaInst>(&I))
+                {
+                    if (isTrackable(alloca, &F))
+                    {
+                        getDomain().push_back(alloca);
+                    }
+                }
+                for (auto &op : I.operands())
+                {
+                    auto global = dyn_cast<GlobalVariable>(op.get());
+                    if (global != nullptr &&
+                        std::find(getDomain().begin(), getDomain().end(), global) == getDomain().end() &&
+                        isTrackable(global, &F))
+                    {
+                        getDomain().push_back(global);
+                    }
+                }
+            }
+        }
+
+        if (isTooLarge())
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < getDomain().size(); ++i)
+        {
+            if (isa<GlobalVariable>(getDomain()[i]))
+            {
+                globalLocations.set(i);
+            }
+        }
+
+        for (auto &BB : F)
+        {
+            InBB[&BB] = BitVector(256, false);
+            OutBB[&BB] = BitVector(256, false);
+        }
+    }
+
+    bool isTooLarge()
+    {
+        return getDomain().size() > 256;
+    }
+
+    // Local must alias check. Every use of the location in F has to be a simple load or a simple store to it
+    bool isTrackable(Value *location, Function *F)
+    {
+        if (auto global = dyn_cast<GlobalVariable>(location))
+        {
+            if (global->isConstant() || !global->hasInitializer())
+            {
+                return false;
+            }
+        }
+
+        for (auto user : location->users())
+        {
+            auto I = dyn_cast<Instruction>(user);
+            if (I == nullptr)
+            {
+                // Used by a constant expression (e.g a GEP or a cast)
+                return false;
+            }
+            if (I->getFunction() != F)
+            {
+                continue;
+            }
+            if (auto load = dyn_cast<LoadInst>(I))
+            {
+                if (!load->isSimple())
+                {
+                    return false;
+                }
+            }
+            else if (auto store = dyn_cast<StoreInst>(I))
+            {
+                // Storing the address itself makes the location escape
+                if (!store->isSimple() || store->getValueOperand() == location)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int getLocationIdx(Value *pointer)
+    {
+        auto itr = std::find(getDomain().begin(), getDomain().end(), pointer);
+        if (itr == getDomain().end())
+        {
+            return -1;
+        }
+        return itr - getDomain().begin();
+    }
+
+    // Instructions other than loads of tracked locations that may read memory (calls, loads through
+    // unknown pointers) may read any global, and so may the caller if an instruction throws.
+    // Allocas are not affected since they do not escape
+    bool mayReadGlobals(Instruction &I)
+    {
+        if (auto load = dyn_cast<LoadInst>(&I))
+        {
+            return getLocationIdx(load->getPointerOperand()) == -1;
+        }
+        return I.mayReadFromMemory() || I.mayThrow();
+    }
+
+    /**
+     * @brief Computes the live locations before an instruction, given the live locations after it
+     */
+    void transferInst(Instruction &I, BitVector &live)
+    {
+        if (auto store = dyn_cast<StoreInst>(&I))
+        {
+            int idx = getLocationIdx(store->getPointerOperand());
+            if (idx != -1)
+            {
+                live.reset(idx);
+                return;
+            }
+        }
+        if (auto load = dyn_cast<LoadInst>(&I))
+        {
+            int idx = getLocationIdx(load->getPointerOperand());
+            if (idx != -1)
+            {
+                live.set(idx);
+                return;
+            }
+        }
+        if (mayReadGlobals(I))
+        {
+            live |= globalLocations;
+        }
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool) override
+    {
+        // Globals are live on exit from the function
+        if (succ_empty(&BB))
+        {
+            return globalLocations;
+        }
+
+        BitVector newOut = BitVector(256, false);
+        for (auto succBB : successors(&BB))
+        {
+            newOut |= InBB[succBB];
+        }
+        return newOut;
+    }
+
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector useSet, defSet;
+        std::tie(useSet, defSet) = getGenAndKillSet(BB);
+
+        auto newIn = defSet.flip();
+        newIn &= OutBB[&BB];
+        newIn |= useSet;
+        return newIn;
+    }
+
+    // Gen is the set of locations read before being written in the block, Kill the set of written locations
+    std::pair<BitVector, BitVector> getGenAndKillSet(BasicBlock &BB) override
+    {
+        if ((GenBB.find(&BB) != GenBB.end()) && (KillBB.find(&BB) != KillBB.end()))
+        {
+            return std::pair<BitVector, BitVector>(GenBB[&BB], KillBB[&BB]);
+        }
+
+        BitVector useSet(256, false);
+        BitVector defSet(256, false);
+
+        for (auto inst = BB.rbegin(); inst != BB.rend(); ++inst)
+        {
+            if (auto store = dyn_cast<StoreInst>(&*inst))
+            {
+                int idx = getLocationIdx(store->getPointerOperand());
+                if (idx != -1)
+                {
+                    defSet.set(idx);
+                }
+            }
+            transferInst(*inst, useSet);
+        }
+
+        GenBB.insert(std::pair<BasicBlock *, BitVector>(&BB, useSet));
+        KillBB.insert(std::pair<BasicBlock *, BitVector>(&BB, defSet));
+
+        return std::pair<BitVector, BitVector>(useSet, defSet);
+    }
+};
+
+class DeadStoreEliminationPass : public FunctionPass
+{
+  public:
+    static char ID;
+
+    DeadStoreEliminationPass() : FunctionPass(ID)
+    {
+    }
+
+    virtual bool runOnFunction(Function &F)
+    {
+        if (F.isDeclaration())
+        {
+            return false;
+        }
+
+        MemoryLivenessDataflow mdf(F);
+        if (mdf.isTooLarge())
+        {
+            outs() << "Function " << F.getName() << " has too many memory locations for dead store elimination\n";
+            return false;
+        }
+
+        mdf.performDFA(F);
+
+        // A store is dead if its location is not live right after it
+        std::vector<Instruction *> deadStores;
+        for (auto &BB : F)
+        {
+            BitVector live = mdf.OutBB[&BB];
+            for (auto inst = BB.rbegin(); inst != BB.rend(); ++inst)
+            {
+                if (auto store = dyn_cast<StoreInst>(&*inst))
+                {
+                    int idx = mdf.getLocationIdx(store->getPointerOperand());
+                    if (idx != -1 && !live[idx])
+                    {
+                        outs() << *store << " Can Be Removed\n";
+                        deadStores.push_back(store);
+                    }
+                }
+                mdf.transferInst(*inst, live);
+            }
+        }
+
+        for (auto store : deadStores)
+        {
+            store->eraseFromParent();
+        }
+
+        outs() << "Function " << F.getName() << " - Dead Stores : " << deadStores.size() << "\n";
+
+        return deadStores.size() > 0;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+    }
+
+  private:
+};
+
+char DeadStoreEliminationPass::ID = 0;
+RegisterPass<DeadStoreEliminationPass> X("dead-store", "Dead Store Elimination");
+} // namespace
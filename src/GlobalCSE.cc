@@ -0,0 +1,199 @@
+#include "AvailableExpressions.h"
+
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+
+/**
+ * @brief Global Common Subexpression Elimination.
+ * Every computation of an expression that is available on entry to its block is
+ * replaced with the computation that reaches it. When more than one computation
+ * reaches the block, the values are merged with PHI nodes.
+ *
+ */
+class GlobalCSEPass : public FunctionPass
+{
+  public:
+    static char ID;
+
+    GlobalCSEPass() : FunctionPass(ID)
+    {
+    }
+
+    // Follow the chain of replacements so that we never reuse an erased value
+    Value *getReplacement(DenseMap<Instruction *, Value *> &replacements, Value *V)
+    {
+        auto I = dyn_cast<Instruction>(V);
+        while (I != nullptr && replacements.find(I) != replacements.end())
+        {
+            V = replacements[I];
+            I = dyn_cast<Instruction>(V);
+        }
+        return V;
+    }
+
+    virtual bool runOnFunction(Function &F)
+    {
+        AvailableExpressionDataflow avf(F);
+        if (avf.isTooLarge())
+        {
+            outs() << "Function " << F.getName() << " has too many expressions for global CSE\n";
+            return false;
+        }
+        avf.performDFA(F);
+
+        // First computation of every expression in each block
+        std::map<int, std::vector<std::pair<BasicBlock *, Instruction *>>> firstComputations;
+        // Computations redundant because the expression is available on entry to the block
+        std::map<int, std::vector<Instruction *>> redundantOnEntry;
+        // Computations redundant because of an earlier computation in the same block
+        std::vector<std::pair<Instruction *, Instruction *>> localRedundant;
+        // Expression computed by every binary operator, looked up before any operand is replaced
+        DenseMap<Instruction *, int> exprOf;
+
+        for (auto &BB : F)
+        {
+            std::map<int, Instruction *> seenInBlock;
+            for (auto &inst : BB)
+            {
+                if (!isa<BinaryOperator>(&inst))
+                {
+                    continue;
+                }
+                int exprIdx = avf.getExprIdx(Expression(&inst));
+                if (exprIdx == -1)
+                {
+                    continue;
+                }
+
+                exprOf[&inst] = exprIdx;
+
+                if (seenInBlock.find(exprIdx) != seenInBlock.end())
+                {
+                    localRedundant.push_back(std::make_pair(&inst, seenInBlock[exprIdx]));
+                    continue;
+                }
+
+                seenInBlock[exprIdx] = &inst;
+                firstComputations[exprIdx].push_back(std::make_pair(&BB, &inst));
+                if (avf.InBB[&BB][exprIdx])
+                {
+                    redundantOnEntry[exprIdx].push_back(&inst);
+                }
+            }
+        }
+
+        // ---------------------
+        // FIND THE REACHING COMPUTATION FOR EVERY REDUNDANT EXPRESSION
+        // ---------------------
+
+        DenseMap<Instruction *, Value *> replacements;
+        SmallVector<PHINode *, 16> insertedPhis;
+
+        for (auto &localPair : localRedundant)
+        {
+            replacements[localPair.first] = localPair.second;
+        }
+
+        for (auto &redundant : redundantOnEntry)
+        {
+            auto &computations = firstComputations[redundant.first];
+            Instruction *sample = computations.front().second;
+
+            SSAUpdater SSA(&insertedPhis);
+            SSA.Initialize(sample->getType(), "gcse-" + sample->getName().str());
+            for (auto &computation : computations)
+            {
+                SSA.AddAvailableValue(computation.first, computation.second);
+            }
+
+            for (auto inst : redundant.second)
+            {
+                Value *V = SSA.GetValueInMiddleOfBlock(inst->getParent());
+                if (V != inst)
+                {
+                    replacements[inst] = V;
+                }
+            }
+        }
+
+        // ---------------------
+        // REPLACE AND REMOVE THE REDUNDANT COMPUTATIONS
+        // ---------------------
+
+        std::vector<Instruction *> toRemove;
+        for (auto &replacement : replacements)
+        {
+            Instruction *inst = replacement.first;
+            Value *V = getReplacement(replacements, replacement.second);
+            if (V == inst)
+            {
+                continue;
+            }
+
+            // The surviving computation may carry flags (nsw, exact) the removed one did not
+            if (auto survivor = dyn_cast<BinaryOperator>(V))
+            {
+                survivor->andIRFlags(inst);
+            }
+            else if (isa<PHINode>(V))
+            {
+                for (auto &computation : firstComputations[exprOf[inst]])
+                {
+                    computation.second->andIRFlags(inst);
+                }
+            }
+
+            inst->replaceAllUsesWith(V);
+            toRemove.push_back(inst);
+        }
+
+        for (auto inst : toRemove)
+        {
+            inst->eraseFromParent();
+        }
+
+        // PHIs that only merge a value with itself (e.g. around a loop) are not needed
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto &phi : insertedPhis)
+            {
+                if (phi == nullptr)
+                {
+                    continue;
+                }
+                Value *V = phi->hasConstantValue();
+                if (V != nullptr && V != phi)
+                {
+                    phi->replaceAllUsesWith(V);
+                    phi->eraseFromParent();
+                    phi = nullptr;
+                    changed = true;
+                }
+            }
+        }
+
+        outs() << "Function " << F.getName() << " - Eliminated Instructions : " << toRemove.size() << "\n";
+
+        return toRemove.size() > 0;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+    }
+
+  private:
+};
+
+char GlobalCSEPass::ID = 0;
+RegisterPass<GlobalCSEPass> X("gcse", "Global Common Subexpression Elimination");
+} // namespace
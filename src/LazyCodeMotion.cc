@@ -0,0 +1,541 @@
+#include "Dataflow.h"
+#include "Expression.h"
+
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+
+/**
+ * @brief The expressions of a function along with the e_use and e_kill sets of every block.
+ * These are shared by all the DFAs of lazy code motion so that every BitVector uses the same indices
+ *
+ */
+class LCMExpressionInfo
+{
+  public:
+    std::vector<Expression> domain;
+    // Expressions computed in the block before any of their operands is defined in the block
+    ValueMap<BasicBlock *, BitVector> EUse;
+    // Expressions with an operand defined in the block
+    ValueMap<BasicBlock *, BitVector> EKill;
+
+    // Computations are inserted on paths that did not compute them before, e.g above a call that may not
+    // return. So divisions and remainders that may trap are left where they are
+    static bool isCandidate(Instruction &inst)
+    {
+        return isa<BinaryOperator>(&inst) && isSafeToSpeculativelyExecute(&inst);
+    }
+
+    int getExprIdx(const Expression &expr)
+    {
+        auto itr = std::find(domain.begin(), domain.end(), expr);
+        if (itr == domain.end())
+        {
+            return -1;
+        }
+        return itr - domain.begin();
+    }
+
+    LCMExpressionInfo(Function &F)
+    {
+        for (auto &BB : F)
+        {
+            for (auto &inst : BB)
+            {
+                if (isCandidate(inst) && getExprIdx(Expression(&inst)) == -1)
+                {
+                    domain.push_back(Expression(&inst));
+                }
+            }
+        }
+
+        if (domain.size() > 256)
+        {
+            return;
+        }
+
+        for (auto &BB : F)
+        {
+            EUse[&BB] = BitVector(256, false);
+            EKill[&BB] = BitVector(256, false);
+
+            for (auto &inst : BB)
+            {
+                if (isCandidate(inst))
+                {
+                    // In SSA, the operands of an expression are defined before it. So the expression is
+                    // upward exposed unless one of its operands is defined in this very block
+                    bool exposed = true;
+                    for (auto &op : inst.operands())
+                    {
+                        auto opInst = dyn_cast<Instruction>(op.get());
+                        if (opInst != nullptr && opInst->getParent() == &BB)
+                        {
+                            exposed = false;
+                        }
+                    }
+                    if (exposed)
+                    {
+                        EUse[&BB].set(getExprIdx(Expression(&inst)));
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < domain.size(); ++i)
+            {
+                for (auto operand : {domain[i].v1, domain[i].v2})
+                {
+                    auto opInst = dyn_cast<Instruction>(operand);
+                    if (opInst != nullptr && opInst->getParent() == &BB)
+                    {
+                        EKill[&BB].set(i);
+                    }
+                }
+            }
+        }
+    }
+
+    bool isTooLarge()
+    {
+        return domain.size() > 256;
+    }
+};
+
+/**
+ * @brief Base for the DFAs of lazy code motion. The Gen and Kill sets are the e_use and e_kill sets
+ *
+ */
+class LCMDataflow : public Dataflow<Expression>
+{
+  protected:
+    LCMExpressionInfo &info;
+
+  public:
+    LCMDataflow(Function &F, LCMExpressionInfo &info, Direction direction, bool top)
+        : Dataflow(direction), info(info)
+    {
+        getDomain() = info.domain;
+        for (auto &BB : F)
+        {
+            InBB[&BB] = BitVector(256, top);
+            OutBB[&BB] = BitVector(256, top);
+        }
+    }
+
+    std::pair<BitVector, BitVector> getGenAndKillSet(BasicBlock &BB) override
+    {
+        return std::pair<BitVector, BitVector>(info.EUse[&BB], info.EKill[&BB]);
+    }
+
+    // Meet over all predecessors (successors) for a FORWARDS (BACKWARDS) DFA.
+    // Boundary blocks get the empty set
+    BitVector meetOver(BasicBlock &BB, bool isEntryBB, bool isIntersection)
+    {
+        BitVector newVal(256, isIntersection);
+        bool isBoundary = true;
+
+        if (getDirection() == FORWARDS)
+        {
+            for (auto predBB : predecessors(&BB))
+            {
+                if (isIntersection)
+                {
+                    newVal &= OutBB[predBB];
+                }
+                else
+                {
+                    newVal |= OutBB[predBB];
+                }
+            }
+            // Only the entry block is a boundary, unreachable blocks are left at the top
+            isBoundary = isEntryBB;
+        }
+        else
+        {
+            for (auto succBB : successors(&BB))
+            {
+                isBoundary = false;
+                if (isIntersection)
+                {
+                    newVal &= InBB[succBB];
+                }
+                else
+                {
+                    newVal |= InBB[succBB];
+                }
+            }
+        }
+
+        if (isBoundary)
+        {
+            newVal.reset();
+        }
+        return newVal;
+    }
+};
+
+// anticipated.in[B] = e_use[B] U (anticipated.out[B] - e_kill[B])
+class AnticipatedExpressionsDataflow : public LCMDataflow
+{
+  public:
+    AnticipatedExpressionsDataflow(Function &F, LCMExpressionInfo &info) : LCMDataflow(F, info, BACKWARDS, true)
+    {
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool isEntryBB) override
+    {
+        return meetOver(BB, isEntryBB, true);
+    }
+
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector useSet, killSet;
+        std::tie(useSet, killSet) = getGenAndKillSet(BB);
+
+        auto newIn = killSet.flip();
+        newIn &= OutBB[&BB];
+        newIn |= useSet;
+        return newIn;
+    }
+};
+
+// available.out[B] = (anticipated.in[B] U available.in[B]) - e_kill[B]
+class WillBeAvailableDataflow : public LCMDataflow
+{
+    AnticipatedExpressionsDataflow &anticipated;
+
+  public:
+    WillBeAvailableDataflow(Function &F, LCMExpressionInfo &info, AnticipatedExpressionsDataflow &anticipated)
+        : LCMDataflow(F, info, FORWARDS, true), anticipated(anticipated)
+    {
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool isEntryBB) override
+    {
+        return meetOver(BB, isEntryBB, true);
+    }
+
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector useSet, killSet;
+        std::tie(useSet, killSet) = getGenAndKillSet(BB);
+
+        auto newOut = anticipated.InBB[&BB];
+        newOut |= InBB[&BB];
+        newOut &= killSet.flip();
+        return newOut;
+    }
+};
+
+// postponable.out[B] = (earliest[B] U postponable.in[B]) - e_use[B]
+class PostponableExpressionsDataflow : public LCMDataflow
+{
+    ValueMap<BasicBlock *, BitVector> &earliest;
+
+  public:
+    PostponableExpressionsDataflow(Function &F, LCMExpressionInfo &info, ValueMap<BasicBlock *, BitVector> &earliest)
+        : LCMDataflow(F, info, FORWARDS, true), earliest(earliest)
+    {
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool isEntryBB) override
+    {
+        return meetOver(BB, isEntryBB, true);
+    }
+
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector useSet, killSet;
+        std::tie(useSet, killSet) = getGenAndKillSet(BB);
+
+        auto newOut = earliest[&BB];
+        newOut |= InBB[&BB];
+        newOut &= useSet.flip();
+        return newOut;
+    }
+};
+
+// used.in[B] = (e_use[B] U used.out[B]) - latest[B]
+class UsedExpressionsDataflow : public LCMDataflow
+{
+    ValueMap<BasicBlock *, BitVector> &latest;
+
+  public:
+    UsedExpressionsDataflow(Function &F, LCMExpressionInfo &info, ValueMap<BasicBlock *, BitVector> &latest)
+        : LCMDataflow(F, info, BACKWARDS, false), latest(latest)
+    {
+    }
+
+    BitVector meetOp(BasicBlock &BB, bool isEntryBB) override
+    {
+        return meetOver(BB, isEntryBB, false);
+    }
+
+    BitVector transferFunc(BasicBlock &BB) override
+    {
+        BitVector useSet, killSet;
+        std::tie(useSet, killSet) = getGenAndKillSet(BB);
+
+        auto newIn = latest[&BB];
+        newIn.flip();
+        useSet |= OutBB[&BB];
+        newIn &= useSet;
+        return newIn;
+    }
+};
+
+/**
+ * @brief Partial Redundancy Elimination using Lazy Code Motion.
+ * Every edge into a join block gets its own block, so that computations can be placed on edges.
+ * The edge blocks that stay empty are removed at the end
+ *
+ */
+class LazyCodeMotionPass : public FunctionPass
+{
+  public:
+    static char ID;
+
+    LazyCodeMotionPass() : FunctionPass(ID)
+    {
+    }
+
+    std::vector<BasicBlock *> splitJoinEdges(Function &F)
+    {
+        std::vector<std::pair<BasicBlock *, BasicBlock *>> edges;
+        for (auto &BB : F)
+        {
+            if (BB.getSinglePredecessor() != nullptr || BB.isEHPad())
+            {
+                continue;
+            }
+            for (auto predBB : predecessors(&BB))
+            {
+                // Only simple branches with a single edge to the block can be split
+                if (!isa<BranchInst>(predBB->getTerminator()) ||
+                    std::count(succ_begin(predBB), succ_end(predBB), &BB) != 1)
+                {
+                    continue;
+                }
+                if (std::find(edges.begin(), edges.end(), std::make_pair(predBB, &BB)) == edges.end())
+                {
+                    edges.push_back(std::make_pair(predBB, &BB));
+                }
+            }
+        }
+
+        std::vector<BasicBlock *> edgeBlocks;
+        for (auto &edge : edges)
+        {
+            auto edgeBlock = SplitEdge(edge.first, edge.second);
+            edgeBlock->setName("lcm-edge");
+            edgeBlocks.push_back(edgeBlock);
+        }
+        return edgeBlocks;
+    }
+
+    virtual bool runOnFunction(Function &F)
+    {
+        if (F.isDeclaration())
+        {
+            return false;
+        }
+
+        std::vector<BasicBlock *> edgeBlocks = splitJoinEdges(F);
+
+        LCMExpressionInfo info(F);
+        if (info.isTooLarge())
+        {
+            outs() << "Function " << F.getName() << " has too many expressions for lazy code motion\n";
+            bool changed = false;
+            for (auto edgeBlock : edgeBlocks)
+            {
+                changed |= !TryToSimplifyUncondBranchFromEmptyBlock(edgeBlock);
+            }
+            return changed;
+        }
+
+        // ---------------------
+        // ANTICIPATED AND (WILL BE) AVAILABLE EXPRESSIONS
+        // ---------------------
+
+        AnticipatedExpressionsDataflow anticipated(F, info);
+        anticipated.performDFA(F);
+
+        WillBeAvailableDataflow available(F, info, anticipated);
+        available.performDFA(F);
+
+        // earliest[B] = anticipated.in[B] - available.in[B]
+        ValueMap<BasicBlock *, BitVector> earliest;
+        for (auto &BB : F)
+        {
+            auto notAvailable = available.InBB[&BB];
+            earliest[&BB] = anticipated.InBB[&BB];
+            earliest[&BB] &= notAvailable.flip();
+        }
+
+        // ---------------------
+        // POSTPONABLE EXPRESSIONS AND LATEST PLACEMENT
+        // ---------------------
+
+        PostponableExpressionsDataflow postponable(F, info, earliest);
+        postponable.performDFA(F);
+
+        // latest[B] = (earliest[B] U postponable.in[B]) &
+        //             (e_use[B] U !(&(earliest[S] U postponable.in[S])) for every successor S of B)
+        ValueMap<BasicBlock *, BitVector> latest;
+        for (auto &BB : F)
+        {
+            auto candidates = earliest[&BB];
+            candidates |= postponable.InBB[&BB];
+
+            BitVector succCandidates(256, true);
+            for (auto succBB : successors(&BB))
+            {
+                auto succCandidate = earliest[succBB];
+                succCandidate |= postponable.InBB[succBB];
+                succCandidates &= succCandidate;
+            }
+            if (succ_empty(&BB))
+            {
+                succCandidates.reset();
+            }
+            succCandidates.flip();
+            succCandidates |= info.EUse[&BB];
+
+            latest[&BB] = candidates;
+            latest[&BB] &= succCandidates;
+        }
+
+        // ---------------------
+        // USED EXPRESSIONS
+        // ---------------------
+
+        UsedExpressionsDataflow used(F, info, latest);
+        used.performDFA(F);
+
+        // ---------------------
+        // TRANSFORMATION
+        // ---------------------
+
+        int numInserted = 0;
+        int numDeleted = 0;
+
+        for (size_t exprIdx = 0; exprIdx < info.domain.size(); ++exprIdx)
+        {
+            auto &expr = info.domain[exprIdx];
+            SmallVector<PHINode *, 8> insertedPhis;
+            SSAUpdater SSA(&insertedPhis);
+            bool hasTemp = false;
+
+            std::vector<std::pair<BasicBlock *, std::vector<Instruction *>>> computations;
+
+            for (auto &BB : F)
+            {
+                std::vector<Instruction *> blockComputations;
+                if (info.EUse[&BB][exprIdx])
+                {
+                    for (auto &inst : BB)
+                    {
+                        if (LCMExpressionInfo::isCandidate(inst) && Expression(&inst) == expr)
+                        {
+                            blockComputations.push_back(&inst);
+                        }
+                    }
+                }
+
+                bool isLatest = latest[&BB][exprIdx];
+                bool isUsedOut = used.OutBB[&BB][exprIdx];
+
+                // Insert t = x at the start of B if x is in latest[B] & used.out[B]
+                if (isLatest && isUsedOut)
+                {
+                    if (!hasTemp)
+                    {
+                        SSA.Initialize(expr.v1->getType(), "lcm-tmp");
+                        hasTemp = true;
+                    }
+                    auto temp =
+                        BinaryOperator::Create(expr.op, expr.v1, expr.v2, "lcm-tmp", &*BB.getFirstInsertionPt());
+                    SSA.AddAvailableValue(&BB, temp);
+                    ++numInserted;
+                }
+
+                if (blockComputations.empty())
+                {
+                    continue;
+                }
+
+                if (!isLatest || isUsedOut)
+                {
+                    // Replace every original computation of x in B by t
+                    computations.push_back(std::make_pair(&BB, blockComputations));
+                }
+                else
+                {
+                    // x is isolated in B. Keep the first computation and reuse it in the rest of the block
+                    for (size_t i = 1; i < blockComputations.size(); ++i)
+                    {
+                        blockComputations[i]->replaceAllUsesWith(blockComputations[0]);
+                        blockComputations[i]->eraseFromParent();
+                        ++numDeleted;
+                    }
+                }
+            }
+
+            if (!hasTemp)
+            {
+                continue;
+            }
+
+            for (auto &computation : computations)
+            {
+                Value *temp = SSA.GetValueAtEndOfBlock(computation.first);
+                for (auto inst : computation.second)
+                {
+                    inst->replaceAllUsesWith(temp);
+                    inst->eraseFromParent();
+                    ++numDeleted;
+                }
+            }
+        }
+
+        // Remove the edge blocks where nothing was placed, and fold the others back
+        // into their predecessor when the edge was not critical
+        bool changed = numInserted > 0 || numDeleted > 0;
+        for (auto edgeBlock : edgeBlocks)
+        {
+            if (edgeBlock->size() == 1)
+            {
+                changed |= !TryToSimplifyUncondBranchFromEmptyBlock(edgeBlock);
+            }
+            else
+            {
+                MergeBlockIntoPredecessor(edgeBlock);
+            }
+        }
+
+        outs() << "Function " << F.getName() << " - Inserted Computations : " << numInserted
+               << ", Deleted Computations : " << numDeleted << "\n";
+
+        return changed;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+    }
+
+  private:
+};
+
+char LazyCodeMotionPass::ID = 0;
+RegisterPass<LazyCodeMotionPass> X("lcm", "Partial Redundancy Elimination using Lazy Code Motion");
+} // namespace
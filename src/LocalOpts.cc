@@ -1,176 +1,268 @@
 #include <iostream>
-#include <set>
+#include <map>
 #include <utility>
 
 #include "Common.h"
+#include "SCCP.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DivisionByConstantInfo.h"
 
 using namespace llvm;
 
 namespace
 {
-    // Helpler function to check if the instruction is an Add Inst
-    bool isAddInst(unsigned int opcode)
+    // ---------------------
+    // REWRITE RULES
+    // ---------------------
+
+    // Patterns an operand of a rule has to match
+    enum OperandPattern
     {
-        bool ret;
-        switch (opcode)
+        ANY,
+        ZERO,
+        ONE,
+        ALL_ONES,
+        // A power of two, as an unsigned value
+        POWER_OF_TWO,
+        // The same value as the other operand
+        SAME,
+    };
+
+    // What an instruction matching a rule is replaced with. The log2 results shift the left operand
+    // by the log2 of the right operand, AND_LOW_BITS keeps the bits of the left operand below the right operand
+    enum RuleResult
+    {
+        LHS,
+        NEG_LHS,
+        ZERO_VALUE,
+        ONE_VALUE,
+        ALL_ONES_VALUE,
+        SHL_LOG2,
+        LSHR_LOG2,
+        AND_LOW_BITS,
+    };
+
+    struct RewriteRule
+    {
+        unsigned opcode;
+        OperandPattern lhs;
+        OperandPattern rhs;
+        RuleResult result;
+        const char *name;
+    };
+
+    /**
+     * @brief The algebraic identities and strength reductions, grouped by opcode in the order of the opcodes.
+     * The rules of an opcode are tried in order, the operands of commutative instructions in both orders
+     *
+     */
+    constexpr RewriteRule rewriteRules[] = {
+        {Instruction::Add, ANY, ZERO, LHS, "x + 0"},
+
+        {Instruction::Sub, ANY, ZERO, LHS, "x - 0"},
+        {Instruction::Sub, ANY, SAME, ZERO_VALUE, "x - x"},
+
+        {Instruction::Mul, ANY, ZERO, ZERO_VALUE, "x * 0"},
+        {Instruction::Mul, ANY, ONE, LHS, "x * 1"},
+        {Instruction::Mul, ANY, POWER_OF_TWO, SHL_LOG2, "x * 2^k"},
+
+        {Instruction::UDiv, ANY, ONE, LHS, "x / 1"},
+        {Instruction::UDiv, ANY, SAME, ONE_VALUE, "x / x"},
+        {Instruction::UDiv, ZERO, ANY, ZERO_VALUE, "0 / x"},
+        {Instruction::UDiv, ANY, POWER_OF_TWO, LSHR_LOG2, "x / 2^k"},
+
+        {Instruction::SDiv, ANY, ONE, LHS, "x / 1"},
+        {Instruction::SDiv, ANY, SAME, ONE_VALUE, "x / x"},
+        {Instruction::SDiv, ZERO, ANY, ZERO_VALUE, "0 / x"},
+        {Instruction::SDiv, ANY, ALL_ONES, NEG_LHS, "x / -1"},
+
+        {Instruction::URem, ANY, ONE, ZERO_VALUE, "x % 1"},
+        {Instruction::URem, ANY, SAME, ZERO_VALUE, "x % x"},
+        {Instruction::URem, ZERO, ANY, ZERO_VALUE, "0 % x"},
+        {Instruction::URem, ANY, POWER_OF_TWO, AND_LOW_BITS, "x % 2^k"},
+
+        {Instruction::SRem, ANY, ONE, ZERO_VALUE, "x % 1"},
+        {Instruction::SRem, ANY, ALL_ONES, ZERO_VALUE, "x % -1"},
+        {Instruction::SRem, ANY, SAME, ZERO_VALUE, "x % x"},
+        {Instruction::SRem, ZERO, ANY, ZERO_VALUE, "0 % x"},
+
+        {Instruction::Shl, ANY, ZERO, LHS, "x << 0"},
+        {Instruction::Shl, ZERO, ANY, ZERO_VALUE, "0 << x"},
+
+        {Instruction::LShr, ANY, ZERO, LHS, "x >> 0"},
+        {Instruction::LShr, ZERO, ANY, ZERO_VALUE, "0 >> x"},
+
+        {Instruction::AShr, ANY, ZERO, LHS, "x >> 0"},
+        {Instruction::AShr, ZERO, ANY, ZERO_VALUE, "0 >> x"},
+        {Instruction::AShr, ALL_ONES, ANY, ALL_ONES_VALUE, "-1 >> x"},
+
+        {Instruction::And, ANY, ZERO, ZERO_VALUE, "x & 0"},
+        {Instruction::And, ANY, ALL_ONES, LHS, "x & -1"},
+        {Instruction::And, ANY, SAME, LHS, "x & x"},
+
+        {Instruction::Or, ANY, ZERO, LHS, "x | 0"},
+        {Instruction::Or, ANY, ALL_ONES, ALL_ONES_VALUE, "x | -1"},
+        {Instruction::Or, ANY, SAME, LHS, "x | x"},
+
+        {Instruction::Xor, ANY, ZERO, LHS, "x ^ 0"},
+        {Instruction::Xor, ANY, SAME, ZERO_VALUE, "x ^ x"},
+    };
+
+    constexpr unsigned NumRules = sizeof(rewriteRules) / sizeof(rewriteRules[0]);
+    constexpr unsigned NumOpcodes = Instruction::OtherOpsEnd;
+
+    constexpr bool rulesSortedByOpcode()
+    {
+        for (unsigned i = 1; i < NumRules; ++i)
         {
-        case Instruction::Add:
-            ret = true;
-            break;
-        default:
-            ret = false;
-            break;
+            if (rewriteRules[i - 1].opcode > rewriteRules[i].opcode)
+            {
+                return false;
+            }
         }
-
-        return ret;
+        return true;
     }
+    static_assert(rulesSortedByOpcode(), "The rewrite rules have to be grouped by opcode, in the order of the opcodes");
 
-    // Helpler function to check if the instruction is a Sub Inst
-    bool isSubInst(unsigned int opcode)
+    // The rules of opcode op are rewriteRules[begin[op]] to rewriteRules[begin[op + 1] - 1]
+    struct RuleIndex
     {
-        bool ret;
-        switch (opcode)
+        unsigned begin[NumOpcodes + 1];
+    };
+
+    constexpr RuleIndex buildRuleIndex()
+    {
+        RuleIndex index{};
+        unsigned rule = 0;
+        for (unsigned op = 0; op <= NumOpcodes; ++op)
         {
-        case Instruction::Sub:
-            ret = true;
-            break;
-        default:
-            ret = false;
-            break;
+            while (rule < NumRules && rewriteRules[rule].opcode < op)
+            {
+                ++rule;
+            }
+            index.begin[op] = rule;
         }
+        return index;
+    }
+
+    // Built at compile time, so an instruction only looks at the rules of its own opcode
+    constexpr RuleIndex ruleIndex = buildRuleIndex();
 
-        return ret;
+    // The value of an integer constant, or of a vector constant whose elements are all equal (a splat),
+    // so that the rules apply to each element of vector operations. nullptr for any other value
+    const APInt *getConstantValue(Value *V)
+    {
+        auto C = dyn_cast<Constant>(V);
+        if (C != nullptr && C->getType()->isVectorTy())
+        {
+            C = C->getSplatValue();
+        }
+        auto constInt = dyn_cast_or_null<ConstantInt>(C);
+        return (constInt != nullptr) ? &constInt->getValue() : nullptr;
     }
 
-    // Helpler function to check if the instruction is a Mul Inst
-    bool isMulInst(unsigned int opcode)
+    bool matchOperand(OperandPattern pattern, Value *operand, Value *other)
     {
-        bool ret;
-        switch (opcode)
+        if (pattern == ANY)
         {
-        case Instruction::Mul:
-            ret = true;
-            break;
-        default:
-            ret = false;
-            break;
+            return true;
+        }
+        if (pattern == SAME)
+        {
+            return operand == other;
         }
 
-        return ret;
+        auto value = getConstantValue(operand);
+        if (value == nullptr)
+        {
+            return false;
+        }
+        switch (pattern)
+        {
+        case ZERO:
+            return value->isZero();
+        case ONE:
+            return value->isOne();
+        case ALL_ONES:
+            return value->isAllOnes();
+        case POWER_OF_TWO:
+            return value->isPowerOf2();
+        default:
+            return false;
+        }
     }
 
-    // Helpler function to check if the instruction is a Division Inst
-    bool isDivInst(unsigned int opcode)
+    // Constants are created with the type of inst, and so are splats for vector operations
+    Value *getRuleResult(const RewriteRule &rule, Instruction &inst, Value *lhs, Value *rhs)
     {
-        bool ret;
-        switch (opcode)
+        auto type = inst.getType();
+        switch (rule.result)
         {
-        case Instruction::SDiv:
-            ret = true;
-            break;
-        case Instruction::UDiv:
-            ret = true;
-            break;
+        case LHS:
+            return lhs;
+        case ZERO_VALUE:
+            return Constant::getNullValue(type);
+        case ONE_VALUE:
+            return ConstantInt::get(type, 1);
+        case ALL_ONES_VALUE:
+            return Constant::getAllOnesValue(type);
+        case NEG_LHS:
+            return BinaryOperator::Create(Instruction::Sub, Constant::getNullValue(type), lhs, "", &inst);
+        case AND_LOW_BITS:
+            return BinaryOperator::Create(Instruction::And, lhs,
+                                          ConstantInt::get(type, *getConstantValue(rhs) - 1), "", &inst);
         default:
-            ret = false;
             break;
         }
 
-        return ret;
+        auto exp = ConstantInt::get(type, getConstantValue(rhs)->logBase2());
+        auto opcode = (rule.result == SHL_LOG2) ? Instruction::Shl : Instruction::LShr;
+        return BinaryOperator::Create(opcode, lhs, exp, "", &inst);
     }
 
     /**
-     * @brief We implement the following algebraic identities in this optimization
-     * x + 0 = 0 + x = x
-     * x - 0 = x
-     * x * 1 = 1 * x = x
-     * x / x = 1
-     * x - x = 0
-     * x * 0 = 0 * x = 0
+     * @brief Applies the first rewrite rule of the instruction's opcode that matches it
      *
      * @param inst
+     * @param rule - Set to the name of the rule applied
+     * @return The value replacing inst, nullptr if no rule matches
      */
-    bool optAlgebraicIdentities(Instruction &inst)
+    Value *applyRewriteRules(Instruction &inst, StringRef &rule)
     {
-        // First identity x + 0 = 0 + x = x
-        bool isAdd = isAddInst(inst.getOpcode());
-
-        if (isAdd == true)
+        if (!isa<BinaryOperator>(&inst) || !inst.getType()->isIntOrIntVectorTy())
         {
-            for (size_t i = 0; i < inst.getNumOperands(); ++i)
-            {
-                auto operand = dyn_cast<ConstantInt>(inst.getOperand(i));
-                if (operand && operand->equalsInt(0))
-                {
-                    outs() << "Found identity ( x + 0 ) \n";
-                    // Removing all the uses
-
-                    auto val = (i == 0) ? inst.getOperand(1) : inst.getOperand(0);
-                    inst.replaceAllUsesWith(val);
-
-                    return true;
-                }
-            }
-        }
-
-        if (isSubInst(inst.getOpcode()) == true)
-        {
-
-            auto operand = dyn_cast<ConstantInt>(inst.getOperand(1));
-            // Identity check for y = x - 0
-            if (operand && operand->equalsInt(0))
-            {
-                outs() << "Found (x - 0) identity \n";
-                auto val = inst.getOperand(0);
-                inst.replaceAllUsesWith(val);
-                return true;
-            }
+            return nullptr;
         }
 
-        if (isMulInst(inst.getOpcode()) == true)
+        unsigned opcode = inst.getOpcode();
+        Value *operands[2] = {inst.getOperand(0), inst.getOperand(1)};
+        unsigned orders = inst.isCommutative() ? 2 : 1;
+        for (unsigned r = ruleIndex.begin[opcode]; r < ruleIndex.begin[opcode + 1]; ++r)
         {
-            for (size_t i = 0; i < inst.getNumOperands(); ++i)
+            auto &rewriteRule = rewriteRules[r];
+            for (unsigned order = 0; order < orders; ++order)
             {
-                auto operand = dyn_cast<ConstantInt>(inst.getOperand(i));
-
-                // Identity check for y = x * 1
-                if (operand && operand->equalsInt(1))
-                {
-                    outs() << "Found (x * 1) identity \n";
-                    // Removing all the uses
-
-                    auto val = (i == 0) ? inst.getOperand(1) : inst.getOperand(0);
-                    inst.replaceAllUsesWith(val);
-
-                    return true;
-                }
-
-                // Identity check for x * 0
-                else if (operand && operand->equalsInt(0))
+                auto lhs = operands[order];
+                auto rhs = operands[1 - order];
+                if (matchOperand(rewriteRule.lhs, lhs, rhs) && matchOperand(rewriteRule.rhs, rhs, lhs))
                 {
-                    outs() << "Found (x * 0) identity \n";
-
-                    auto val = ConstantInt::get(inst.getType(), 0);
-                    inst.replaceAllUsesWith(val);
-                    return true;
+                    outs() << "Found (" << rewriteRule.name << ") \n";
+                    rule = rewriteRule.name;
+                    return getRuleResult(rewriteRule, inst, lhs, rhs);
                 }
             }
         }
-
-        if (isDivInst(inst.getOpcode()) == true)
-        {
-            // Identity check for y = x / 1
-            auto operand = dyn_cast<ConstantInt>(inst.getOperand(1));
-            if (operand->equalsInt(1))
-            {
-                inst.replaceAllUsesWith(ConstantInt::get(inst.getType(), 1));
-            }
-        }
-
-        return false;
+        return nullptr;
     }
 
-    // This is a helper function to get the result of a constant expression
+    // This is a helper function to get the result of a constant expression, nullptr if it can not be folded
     Constant *getConstExprResult(ConstantInt *firstOperand, ConstantInt *secondOperand, unsigned int opcode, Type *type)
     {
         switch (opcode)
@@ -187,142 +279,723 @@ namespace
             return ConstantInt::get(type, firstOperand->getValue() * secondOperand->getValue());
             break;
         case Instruction::SDiv:
+            // Division by zero and the overflowing INT_MIN / -1 are undefined and are left alone
+            if (secondOperand->isZero() || (secondOperand->isMinusOne() && firstOperand->getValue().isMinSignedValue()))
+            {
+                return nullptr;
+            }
             return ConstantInt::get(type, firstOperand->getValue().sdiv(secondOperand->getValue()));
             break;
         case Instruction::UDiv:
+            if (secondOperand->isZero())
+            {
+                return nullptr;
+            }
             return ConstantInt::get(type, firstOperand->getValue().udiv(secondOperand->getValue()));
             break;
 
         default:
             break;
         }
+        return nullptr;
     }
 
-    // This map holds all the constants we have encountered so far
-    ValueMap<Value *, ConstantInt *> consts;
+    // Folds two constant vectors (e.g ConstantDataVector operands) element by element. nullptr if an element
+    // is not an integer (undef) or can not be folded
+    Constant *getVectorConstExprResult(Constant *firstOperand, Constant *secondOperand, unsigned int opcode,
+                                       FixedVectorType *type)
+    {
+        SmallVector<Constant *, 16> elements;
+        for (unsigned i = 0; i < type->getNumElements(); ++i)
+        {
+            auto firstElement = dyn_cast_or_null<ConstantInt>(firstOperand->getAggregateElement(i));
+            auto secondElement = dyn_cast_or_null<ConstantInt>(secondOperand->getAggregateElement(i));
+            if (firstElement == nullptr || secondElement == nullptr)
+            {
+                return nullptr;
+            }
+            auto element = getConstExprResult(firstElement, secondElement, opcode, type->getElementType());
+            if (element == nullptr)
+            {
+                return nullptr;
+            }
+            elements.push_back(element);
+        }
+        return ConstantVector::get(elements);
+    }
 
     // Constant folding optimization
-    bool constFolding(Instruction &inst)
+    Value *constFolding(Instruction &inst)
     {
+        if (Instruction::isBinaryOp(inst.getOpcode()) == true)
+        {
+            auto firstOperand = dyn_cast<ConstantInt>(inst.getOperand(0));
+            auto secondOperand = dyn_cast<ConstantInt>(inst.getOperand(1));
+
+            if (firstOperand && secondOperand)
+            {
+                // Both the operands are constant
+                return getConstExprResult(firstOperand, secondOperand, inst.getOpcode(), inst.getType());
+            }
 
-        if (inst.getOpcode() == Instruction::Store)
+            auto vectorType = dyn_cast<FixedVectorType>(inst.getType());
+            auto firstVector = dyn_cast<Constant>(inst.getOperand(0));
+            auto secondVector = dyn_cast<Constant>(inst.getOperand(1));
+            if (vectorType != nullptr && vectorType->getElementType()->isIntegerTy() && firstVector && secondVector)
+            {
+                return getVectorConstExprResult(firstVector, secondVector, inst.getOpcode(), vectorType);
+            }
+        }
+        else if (auto select = dyn_cast<SelectInst>(&inst))
         {
-            // We have a store operation
-            auto storeVal = dyn_cast<ConstantInt>(inst.getOperand(0));
-            if (storeVal)
+            // The condition may have been propagated by SCCP. A vector condition must be the same for every element
+            if (auto cond = getConstantValue(select->getCondition()))
             {
-                auto constantVar = inst.getOperand(1);
-                // We insert the variable and its constant value into the consts map
-                if (consts.find(constantVar) != consts.end())
-                {
-                    consts.erase(constantVar);
-                }
-                consts.insert(std::pair<Value *, ConstantInt *>(constantVar, storeVal));
+                return cond->isZero() ? select->getFalseValue() : select->getTrueValue();
+            }
+        }
+        return nullptr;
+    }
 
-                return true;
+    // ---------------------
+    // MULTIPLICATION BY CONSTANTS
+    // ---------------------
+
+    static cl::opt<bool> DecomposeMul("local-opts-mul-decompose",
+                                      cl::desc("Rewrite multiplications by constants as shift, add and sub sequences when cheaper"),
+                                      cl::init(true));
+    static cl::opt<std::string> CostModelName("local-opts-cost-model",
+                                              cl::desc("Target whose costs guide the decomposition (default: the module's target)"),
+                                              cl::init(""));
+
+    // Latencies of the instructions involved, and the most instructions a multiplication may be replaced with
+    struct MulCostModel
+    {
+        const char *target;
+        unsigned add;
+        unsigned sub;
+        unsigned shl;
+        unsigned mul;
+        unsigned maxInsts;
+    };
+
+    // The first entry is used for targets not in the table
+    const MulCostModel mulCostModels[] = {
+        {"generic", 1, 1, 1, 3, 4},
+        {"x86_64", 1, 1, 1, 3, 3},
+        {"aarch64", 1, 1, 1, 4, 4},
+        {"riscv64", 1, 1, 1, 5, 4},
+    };
+
+    const MulCostModel &getMulCostModel(Module &M)
+    {
+        StringRef target = CostModelName;
+        if (target.empty())
+        {
+            target = Triple::getArchTypeName(Triple(M.getTargetTriple()).getArch());
+        }
+        for (auto &model : mulCostModels)
+        {
+            if (target == model.target)
+            {
+                return model;
             }
         }
-        else if (inst.getOpcode() == Instruction::Load)
+        return mulCostModels[0];
+    }
+
+    // A step of a multiplication sequence. Operands are indices of values: -1 is the constant 0, 0 is x
+    // and i + 1 is the result of step i. The right operand of a shift is the shift amount
+    struct MulStep
+    {
+        unsigned opcode;
+        int lhs;
+        int rhs;
+    };
+
+    struct MulPlan
+    {
+        SmallVector<MulStep, 8> steps;
+        SmallVector<unsigned, 8> ready{0};
+        unsigned latency = 0;
+
+        int result() const
+        {
+            return steps.size();
+        }
+
+        unsigned readyTime(int idx) const
         {
+            return (idx < 0) ? 0 : ready[idx];
+        }
 
-            auto loadSource = inst.getOperand(0);
-            auto possibleConst = consts.find(loadSource);
-            if (possibleConst != consts.end())
+        int addStep(unsigned opcode, int lhs, int rhs, const MulCostModel &costs)
+        {
+            unsigned cost = (opcode == Instruction::Shl) ? costs.shl : (opcode == Instruction::Add) ? costs.add : costs.sub;
+            unsigned start = readyTime(lhs);
+            if (opcode != Instruction::Shl)
             {
-                inst.replaceAllUsesWith(possibleConst->second);
-                return true;
+                start = std::max(start, readyTime(rhs));
             }
+            steps.push_back({opcode, lhs, rhs});
+            ready.push_back(start + cost);
+            latency = ready.back();
+            return result();
         }
-        else if (Instruction::isBinaryOp(inst.getOpcode()) == true)
+
+        int shl(int idx, unsigned amount, const MulCostModel &costs)
         {
-            auto firstOperand = dyn_cast<ConstantInt>(inst.getOperand(0));
-            auto secondOperand = dyn_cast<ConstantInt>(inst.getOperand(1));
+            return (amount == 0) ? idx : addStep(Instruction::Shl, idx, amount, costs);
+        }
 
-            if (firstOperand && secondOperand)
+        bool isBetterThan(const MulPlan &other) const
+        {
+            return latency < other.latency || (latency == other.latency && steps.size() < other.steps.size());
+        }
+    };
+
+    /**
+     * @brief Sequence from the canonical signed digit form of the multiplier, where no two adjacent digits are
+     * non zero, e.g x * 7 = (x << 3) - x. Digits at or above the bit width are dropped, they do not change the result
+     *
+     */
+    MulPlan getSignedDigitPlan(const APInt &multiplier, const MulCostModel &costs)
+    {
+        unsigned width = multiplier.getBitWidth();
+        SmallVector<unsigned, 8> positive, negative;
+        APInt c = multiplier.sext(width + 2);
+        for (unsigned pos = 0; !c.isZero() && pos < width; ++pos)
+        {
+            if (c[0])
             {
-                // Both the operands are constant
-                auto val = getConstExprResult(firstOperand, secondOperand, inst.getOpcode(), inst.getType());
-                inst.replaceAllUsesWith(val);
-                return true;
+                if (c[1])
+                {
+                    negative.push_back(pos);
+                    c += 1;
+                }
+                else
+                {
+                    positive.push_back(pos);
+                    c -= 1;
+                }
+            }
+            c.ashrInPlace(1);
+        }
+
+        MulPlan plan;
+        int acc = -1;
+        for (auto pos : positive)
+        {
+            int term = plan.shl(0, pos, costs);
+            acc = (acc == -1) ? term : plan.addStep(Instruction::Add, acc, term, costs);
+        }
+        for (auto pos : negative)
+        {
+            int term = plan.shl(0, pos, costs);
+            acc = plan.addStep(Instruction::Sub, acc, term, costs);
+        }
+        return plan;
+    }
+
+    /**
+     * @brief Cheapest sequence found for x * multiplier. Besides the signed digit form, multipliers with a factor
+     * 2^k + 1 or 2^k - 1 are tried as (y << k) +/- y for y = x * (multiplier / factor), e.g x * 45 = (y << 3) + y
+     * with y = (x << 2) + x, and even multipliers as a shift of x * (multiplier >> trailing zeros)
+     *
+     */
+    MulPlan getMulPlan(int64_t multiplier, unsigned width, const MulCostModel &costs, std::map<int64_t, MulPlan> &memo)
+    {
+        auto known = memo.find(multiplier);
+        if (known != memo.end())
+        {
+            return known->second;
+        }
+
+        MulPlan best = getSignedDigitPlan(APInt(width, multiplier, true), costs);
+
+        auto tryComposite = [&](int64_t base, unsigned shift, unsigned combine) {
+            MulPlan plan = getMulPlan(base, width, costs, memo);
+            int y = plan.result();
+            int shifted = plan.shl(y, shift, costs);
+            if (combine != 0)
+            {
+                plan.addStep(combine, shifted, y, costs);
+            }
+            if (plan.isBetterThan(best))
+            {
+                best = plan;
+            }
+        };
+
+        unsigned trailingZeros = countTrailingZeros(static_cast<uint64_t>(multiplier));
+        if (multiplier != 0 && trailingZeros > 0 && trailingZeros < width)
+        {
+            tryComposite(multiplier >> trailingZeros, trailingZeros, 0);
+        }
+        for (unsigned k = 1; k < std::min(width, 62u); ++k)
+        {
+            int64_t plus = (int64_t(1) << k) + 1;
+            int64_t minus = (int64_t(1) << k) - 1;
+            if (plus < multiplier && multiplier % plus == 0)
+            {
+                tryComposite(multiplier / plus, k, Instruction::Add);
+            }
+            if (k > 1 && minus < multiplier && multiplier % minus == 0)
+            {
+                tryComposite(multiplier / minus, k, Instruction::Sub);
             }
         }
-        return false;
+
+        memo[multiplier] = best;
+        return best;
     }
 
-    // Helper function to check if a number is a power of two
-    bool isPowerOfTwo(unsigned int num)
+    /**
+     * @brief Replaces x * c by a sequence of shifts, adds and subs, if the cost model of the target says it is faster
+     * than the multiplication and it is short enough
+     *
+     * @param inst
+     * @param costs
+     * @param rule - Set to the name of the rule applied
+     * @return The last instruction of the sequence, nullptr if the multiplication is kept
+     */
+    Value *decomposeMultiply(Instruction &inst, const MulCostModel &costs, StringRef &rule)
     {
-        return (num & (num - 1)) == 0 ? true : false;
+        if (!DecomposeMul || inst.getOpcode() != Instruction::Mul || !inst.getType()->isIntOrIntVectorTy() ||
+            inst.getType()->getScalarSizeInBits() > 64)
+        {
+            return nullptr;
+        }
+
+        // Vectors are multiplied by a splat, and the sequence works on every element
+        unsigned constIdx = (getConstantValue(inst.getOperand(1)) != nullptr) ? 1 : 0;
+        auto multiplier = getConstantValue(inst.getOperand(constIdx));
+        if (multiplier == nullptr)
+        {
+            return nullptr;
+        }
+        auto x = inst.getOperand(1 - constIdx);
+
+        std::map<int64_t, MulPlan> memo;
+        unsigned width = inst.getType()->getScalarSizeInBits();
+        MulPlan plan = getMulPlan(multiplier->getSExtValue(), width, costs, memo);
+        if (plan.steps.empty() || plan.latency >= costs.mul || plan.steps.size() > costs.maxInsts)
+        {
+            return nullptr;
+        }
+
+        SmallVector<Value *, 8> values;
+        values.push_back(x);
+        auto getValue = [&](int idx) -> Value * {
+            return (idx < 0) ? Constant::getNullValue(inst.getType()) : values[idx];
+        };
+        for (auto &step : plan.steps)
+        {
+            Value *rhs = (step.opcode == Instruction::Shl) ? ConstantInt::get(inst.getType(), step.rhs) : getValue(step.rhs);
+            values.push_back(BinaryOperator::Create(static_cast<Instruction::BinaryOps>(step.opcode), getValue(step.lhs), rhs, "", &inst));
+        }
+
+        outs() << "Found (x * " << multiplier->getSExtValue() << ") decomposed into " << plan.steps.size()
+               << " instructions\n";
+        rule = "x * c";
+        return values.back();
+    }
+
+    // ---------------------
+    // DIVISION BY CONSTANTS
+    // ---------------------
+
+    static cl::opt<bool> DivideByMagic("local-opts-div-magic",
+                                       cl::desc("Rewrite divisions and remainders by constants as multiplications by magic numbers"),
+                                       cl::init(true));
+
+    // High half of the double width product of x and a constant
+    Value *createMulHigh(IRBuilder<> &builder, Value *x, const APInt &magic, bool isSigned)
+    {
+        unsigned width = x->getType()->getScalarSizeInBits();
+        auto wideType = x->getType()->getWithNewBitWidth(2 * width);
+        auto wideX = isSigned ? builder.CreateSExt(x, wideType) : builder.CreateZExt(x, wideType);
+        auto wideMagic = ConstantInt::get(wideType, isSigned ? magic.sext(2 * width) : magic.zext(2 * width));
+        auto product = builder.CreateMul(wideX, wideMagic);
+        return builder.CreateTrunc(builder.CreateLShr(product, width), x->getType());
+    }
+
+    /**
+     * @brief Signed division by +/- 2^k. An arithmetic shift rounds towards minus infinity, so 2^k - 1 is added
+     * to negative dividends first to round towards zero like sdiv
+     *
+     */
+    Value *createSignedDivByPowerOfTwo(IRBuilder<> &builder, Value *x, const APInt &divisor)
+    {
+        unsigned width = divisor.getBitWidth();
+        unsigned k = divisor.abs().logBase2();
+        auto sign = builder.CreateAShr(x, width - 1);
+        auto bias = builder.CreateLShr(sign, width - k);
+        auto quotient = builder.CreateAShr(builder.CreateAdd(x, bias), k);
+        return divisor.isNegative() ? builder.CreateNeg(quotient) : quotient;
+    }
+
+    /**
+     * @brief Signed division by a constant, following Granlund and Montgomery (as in LLVM's BuildSDIV). The quotient
+     * is the high half of x * magic, corrected by x when the magic number overflowed, shifted, and incremented
+     * when it is negative so that it rounds towards zero
+     *
+     */
+    Value *createSignedDivByMagic(IRBuilder<> &builder, Value *x, const APInt &divisor)
+    {
+        auto magics = SignedDivisionByConstantInfo::get(divisor);
+        unsigned width = divisor.getBitWidth();
+
+        auto quotient = createMulHigh(builder, x, magics.Magic, true);
+        if (divisor.isStrictlyPositive() && magics.Magic.isNegative())
+        {
+            quotient = builder.CreateAdd(quotient, x);
+        }
+        else if (divisor.isNegative() && magics.Magic.isStrictlyPositive())
+        {
+            quotient = builder.CreateSub(quotient, x);
+        }
+        if (magics.ShiftAmount > 0)
+        {
+            quotient = builder.CreateAShr(quotient, magics.ShiftAmount);
+        }
+        return builder.CreateAdd(quotient, builder.CreateLShr(quotient, width - 1));
     }
 
     /**
-     * @brief This function implements the strength reduction optimization
+     * @brief Unsigned division by a constant, as in LLVM's BuildUDIV. Even divisors shift the dividend first so that
+     * the magic number fits, otherwise a magic number that needs one more bit is fixed up with ((x - q) >> 1) + q
+     *
+     */
+    Value *createUnsignedDivByMagic(IRBuilder<> &builder, Value *x, const APInt &divisor)
+    {
+        auto magics = UnsignedDivisonByConstantInfo::get(divisor);
+        unsigned preShift = 0;
+        if (magics.IsAdd && !divisor[0])
+        {
+            preShift = divisor.countTrailingZeros();
+            magics = UnsignedDivisonByConstantInfo::get(divisor.lshr(preShift), preShift);
+        }
+
+        Value *dividend = (preShift > 0) ? builder.CreateLShr(x, preShift) : x;
+        auto quotient = createMulHigh(builder, dividend, magics.Magic, false);
+        unsigned postShift = magics.ShiftAmount;
+        if (magics.IsAdd)
+        {
+            auto npq = builder.CreateLShr(builder.CreateSub(x, quotient), 1);
+            quotient = builder.CreateAdd(npq, quotient);
+            postShift -= 1;
+        }
+        return (postShift > 0) ? builder.CreateLShr(quotient, postShift) : quotient;
+    }
+
+    /**
+     * @brief Replaces sdiv, udiv, srem and urem by constants with shifts and multiplications. The remainders are
+     * computed from the quotient as x - (x / d) * d. Signed divisions by powers of two always use the bias corrected
+     * shift, the other divisors use magic numbers unless -local-opts-div-magic=false. The cases handled by the rewrite
+     * rules (divisors 0, 1, -1, unsigned powers of two) are left to them
      *
      * @param inst
-     * @return true
-     * @return false
+     * @param rule - Set to the name of the rule applied
+     * @return The last instruction of the sequence, nullptr if the division is kept
      */
-    bool strengthReduction(Instruction &inst)
+    Value *divideByConstant(Instruction &inst, StringRef &rule)
     {
-        bool isMul = isMulInst(inst.getOpcode());
+        unsigned opcode = inst.getOpcode();
+        bool isSigned = (opcode == Instruction::SDiv || opcode == Instruction::SRem);
+        bool isRem = (opcode == Instruction::SRem || opcode == Instruction::URem);
+        if (!isSigned && opcode != Instruction::UDiv && opcode != Instruction::URem)
+        {
+            return nullptr;
+        }
 
-        if (isMul == true)
+        // Vectors are divided by a splat
+        auto divisorConst = inst.getOperand(1);
+        auto divisorValue = getConstantValue(divisorConst);
+        if (divisorValue == nullptr || inst.getType()->getScalarSizeInBits() > 64)
         {
-            for (size_t i = 0; i < inst.getNumOperands(); ++i)
-            {
-                auto operand = dyn_cast<ConstantInt>(inst.getOperand(i));
-                auto var = (i == 0) ? inst.getOperand(1) : inst.getOperand(0);
+            return nullptr;
+        }
+        auto &divisor = *divisorValue;
+        if (divisor.isZero() || divisor.isOne() || (isSigned && divisor.isAllOnes()) || (!isSigned && divisor.isPowerOf2()))
+        {
+            return nullptr;
+        }
 
-                if (operand && isPowerOfTwo(operand->getSExtValue()))
-                {
-                    uint64_t exp = (uint64_t)log2(operand->getSExtValue());
-                    auto a = ConstantInt::get(operand->getType(), exp);
-                    // We replace the multiply instruction with left shift
-                    inst.replaceAllUsesWith(BinaryOperator::Create(
-                        Instruction::Shl, var, a, "", &inst));
+        bool isPowerOfTwo = isSigned && (divisor.isMinSignedValue() || divisor.abs().isPowerOf2());
+        if (!isPowerOfTwo && !DivideByMagic)
+        {
+            return nullptr;
+        }
 
-                    return true;
-                }
-            }
+        IRBuilder<> builder(&inst);
+        auto x = inst.getOperand(0);
+        Value *quotient = nullptr;
+        if (isPowerOfTwo)
+        {
+            quotient = createSignedDivByPowerOfTwo(builder, x, divisor);
+        }
+        else if (isSigned)
+        {
+            quotient = createSignedDivByMagic(builder, x, divisor);
         }
+        else
+        {
+            quotient = createUnsignedDivByMagic(builder, x, divisor);
+        }
+
+        Value *result = quotient;
+        if (isRem)
+        {
+            result = builder.CreateSub(x, builder.CreateMul(quotient, divisorConst));
+        }
+
+        outs() << "Found (x " << (isRem ? "% " : "/ ");
+        divisor.print(outs(), isSigned);
+        outs() << ") reduced\n";
+        rule = isPowerOfTwo ? (isRem ? "x % 2^k" : "x / 2^k") : (isRem ? "x % c" : "x / c");
+        return result;
+    }
+
+    // ---------------------
+    // LOCAL VALUE NUMBERING
+    // ---------------------
+
+    static cl::opt<bool> ValueNumbering("local-opts-lvn",
+                                        cl::desc("Replace the computations already made earlier in the same block"),
+                                        cl::init(true));
+
+    // What an instruction computes. Two instructions with equal keys compute the same value, operands are
+    // the values themselves since every duplicate is replaced by the first occurrence as soon as it is found
+    struct ValueKey
+    {
+        unsigned opcode;
+        Type *type;
+        // Predicate of compares, source element type of GEPs
+        unsigned predicate;
+        Type *sourceType;
+        // Memory state a load reads from, 0 for the other instructions
+        unsigned generation;
+        SmallVector<Value *, 4> operands;
+    };
 
-        bool isDiv = isDivInst(inst.getOpcode());
+    struct ValueKeyInfo
+    {
+        static ValueKey getEmptyKey()
+        {
+            return ValueKey{~0U, nullptr, 0, nullptr, 0, {}};
+        }
 
-        if (isDiv == true)
+        static ValueKey getTombstoneKey()
         {
+            return ValueKey{~0U - 1, nullptr, 0, nullptr, 0, {}};
+        }
 
-            auto operand = dyn_cast<ConstantInt>(inst.getOperand(1));
-            auto var = inst.getOperand(0);
+        static unsigned getHashValue(const ValueKey &key)
+        {
+            return hash_combine(key.opcode, key.type, key.predicate, key.sourceType, key.generation,
+                                hash_combine_range(key.operands.begin(), key.operands.end()));
+        }
 
-            if (operand && isPowerOfTwo(operand->getSExtValue()))
-            {
-                uint64_t exp = (uint64_t)log2(operand->getSExtValue());
-                auto a = ConstantInt::get(operand->getType(), exp);
-                // We replace the divide instruction with right shift
-                inst.replaceAllUsesWith(BinaryOperator::Create(
-                    Instruction::AShr, var, a, "", &inst));
+        static bool isEqual(const ValueKey &lhs, const ValueKey &rhs)
+        {
+            return lhs.opcode == rhs.opcode && lhs.type == rhs.type && lhs.predicate == rhs.predicate &&
+                   lhs.sourceType == rhs.sourceType && lhs.generation == rhs.generation && lhs.operands == rhs.operands;
+        }
+    };
 
-                return true;
+    /**
+     * @brief Builds the key of an instruction that may be numbered: binary operators, compares, casts,
+     * GEPs, selects and simple loads. The operands of commutative instructions are sorted, so that a + b
+     * and b + a (or a < b and b > a) get the same key
+     *
+     * @return false if the instruction has side effects or is not handled
+     */
+    bool getValueKey(Instruction &inst, unsigned generation, ValueKey &key)
+    {
+        if (!isa<BinaryOperator>(&inst) && !isa<CmpInst>(&inst) && !isa<CastInst>(&inst) &&
+            !isa<GetElementPtrInst>(&inst) && !isa<SelectInst>(&inst) && !isa<LoadInst>(&inst))
+        {
+            return false;
+        }
+
+        key = ValueKey{inst.getOpcode(), inst.getType(), 0, nullptr, 0, {}};
+        key.operands.append(inst.op_begin(), inst.op_end());
+
+        if (auto load = dyn_cast<LoadInst>(&inst))
+        {
+            if (!load->isSimple())
+            {
+                return false;
             }
+            key.generation = generation;
         }
-        return false;
+        else if (auto gep = dyn_cast<GetElementPtrInst>(&inst))
+        {
+            key.sourceType = gep->getSourceElementType();
+        }
+        else if (auto cmp = dyn_cast<CmpInst>(&inst))
+        {
+            key.predicate = cmp->getPredicate();
+            if (key.operands[1] < key.operands[0])
+            {
+                std::swap(key.operands[0], key.operands[1]);
+                key.predicate = cmp->getSwappedPredicate();
+            }
+        }
+        else if (inst.isCommutative() && key.operands[1] < key.operands[0])
+        {
+            std::swap(key.operands[0], key.operands[1]);
+        }
+        return true;
+    }
+
+    // The key of a load of the location a store writes to, which reads the stored value
+    ValueKey getStoredValueKey(StoreInst &store, unsigned generation)
+    {
+        auto key = ValueKey{Instruction::Load, store.getValueOperand()->getType(), 0, nullptr, generation, {}};
+        key.operands.push_back(store.getPointerOperand());
+        return key;
     }
 
     class LocalOpts : public FunctionPass
     {
     private:
-        unsigned int numConstFolding = 0;
-        unsigned int numAlgebraicIdentity = 0;
-        unsigned int numStrengthReduction = 0;
+        // Costs of the target of the current module, for the multiplication decomposition
+        const MulCostModel *mulCosts = &mulCostModels[0];
+
+        // Number of times each rule fired in the current function, in the order the rules were first hit
+        MapVector<StringRef, unsigned int> ruleHits;
+
+        // Instructions to visit (again). Popped from the back, so it is filled in reverse program order
+        SetVector<Instruction *> WorkList;
+        // Instructions replaced by a simpler value, erased once the worklist is empty
+        SmallPtrSet<Instruction *, 32> replaced;
+        SmallVector<Instruction *, 32> toRemove;
+
+        /**
+         * @brief Replaces inst with a simpler value. The users of inst are pushed back on the worklist,
+         * since their operands changed and they may now be simplified as well (e.g x * 1 feeding a + 0)
+         *
+         */
+        void replaceInst(Instruction &inst, Value *val, StringRef rule)
+        {
+            ++ruleHits[rule];
+
+            for (auto user : inst.users())
+            {
+                if (auto userInst = dyn_cast<Instruction>(user))
+                {
+                    WorkList.insert(userInst);
+                }
+            }
+            // Instructions created by the rule are visited too
+            if (auto valInst = dyn_cast<Instruction>(val))
+            {
+                WorkList.insert(valInst);
+            }
+
+            inst.replaceAllUsesWith(val);
+            replaced.insert(&inst);
+            toRemove.push_back(&inst);
+        }
+
+        /**
+         * @brief Local value numbering of a block. A computation already made earlier in the block is replaced
+         * by the first occurrence. Any instruction that may write memory starts a new generation, so loads
+         * are only reused (or forwarded the value of a store) while no store or call happened in between
+         *
+         * @return true if a duplicate was replaced
+         */
+        bool numberValues(BasicBlock &bb)
+        {
+            DenseMap<ValueKey, Value *, ValueKeyInfo> numbered;
+            unsigned generation = 0;
+            bool changed = false;
+
+            for (auto &inst : bb)
+            {
+                if (replaced.count(&inst) != 0)
+                {
+                    continue;
+                }
+
+                ValueKey key;
+                if (getValueKey(inst, generation, key))
+                {
+                    auto leader = numbered.find(key);
+                    if (leader == numbered.end())
+                    {
+                        numbered[key] = &inst;
+                        continue;
+                    }
+                    // The first occurrence keeps only the flags (nsw, exact, ...) both computations have
+                    auto leaderInst = dyn_cast<Instruction>(leader->second);
+                    if (leaderInst != nullptr && leaderInst->getOpcode() == inst.getOpcode())
+                    {
+                        leaderInst->andIRFlags(&inst);
+                    }
+                    replaceInst(inst, leader->second, isa<LoadInst>(&inst) ? "Redundant Load" : "Value Numbering");
+                    changed = true;
+                    continue;
+                }
+
+                if (inst.mayWriteToMemory())
+                {
+                    ++generation;
+                    auto store = dyn_cast<StoreInst>(&inst);
+                    if (store != nullptr && store->isSimple())
+                    {
+                        numbered[getStoredValueKey(*store, generation)] = store->getValueOperand();
+                    }
+                }
+            }
+            return changed;
+        }
+
+        // Applies the first rule that simplifies inst. Returns true if inst was replaced
+        bool simplifyInst(Instruction &inst)
+        {
+            StringRef rule;
+            if (auto val = constFolding(inst))
+            {
+                replaceInst(inst, val, "Constant Folding");
+                return true;
+            }
+            if (auto val = applyRewriteRules(inst, rule))
+            {
+                replaceInst(inst, val, rule);
+                return true;
+            }
+            if (auto val = decomposeMultiply(inst, *mulCosts, rule))
+            {
+                replaceInst(inst, val, rule);
+                return true;
+            }
+            if (auto val = divideByConstant(inst, rule))
+            {
+                replaceInst(inst, val, rule);
+                // The remainder is x - quotient * c, its multiplication may be decomposed as well
+                auto sub = dyn_cast<BinaryOperator>(val);
+                if (sub != nullptr && sub->getOpcode() == Instruction::Sub)
+                {
+                    if (auto mul = dyn_cast<Instruction>(sub->getOperand(1)))
+                    {
+                        WorkList.insert(mul);
+                    }
+                }
+                return true;
+            }
+            return false;
+        }
 
     public:
         static char ID;
         LocalOpts() : FunctionPass(ID) {}
         ~LocalOpts() {}
-        // We don't modify the program, so we preserve all analyses
+        // Branches on constants are folded and unreachable blocks deleted, so the CFG is not preserved
         void getAnalysisUsage(AnalysisUsage &AU) const override
         {
-            AU.setPreservesAll();
         }
         // Do some initialization.
         // This method run once by the compiler when the module is loaded
@@ -335,50 +1008,84 @@ namespace
         // This method is called for every function in the module
         bool runOnFunction(Function &F) override
         {
+            ruleHits.clear();
+            mulCosts = &getMulCostModel(*F.getParent());
+            WorkList.clear();
+            replaced.clear();
+            toRemove.clear();
 
-            std::set<Instruction *> WorkList;
+            // Constants are first propagated across the blocks and the PHIs, and the never taken branches removed.
+            // The constants are collected before the dead blocks are deleted
+            ConstantPropagationSolver solver(F);
+            solver.solve(F);
+            auto constantInsts = solver.getConstantInsts(F);
+            auto folded = solver.foldBranches(F);
+            if (folded.first > 0)
+            {
+                ruleHits["Branch Folding"] += folded.first;
+            }
+            if (folded.second > 0)
+            {
+                ruleHits["Unreachable Blocks"] += folded.second;
+            }
+            for (auto &constantInst : constantInsts)
+            {
+                replaceInst(*constantInst.first, constantInst.second, "Constant Propagation");
+            }
 
+            // The users of the propagated constants are then simplified by the rules
             for (auto &bb : F)
             {
-                SmallVector<Instruction *, 10> toRemove;
                 for (auto &inst : bb)
                 {
-                    bool remove = constFolding(inst);
-
-                    if (!remove)
+                    if (replaced.count(&inst) != 0)
                     {
-                        remove = strengthReduction(inst);
-                        if (!remove)
-                        {
-                            remove = optAlgebraicIdentities(inst);
-                            if (remove)
-                                ++numAlgebraicIdentity;
-                        }
-                        else
-                        {
-                            ++numStrengthReduction;
-                        }
+                        continue;
                     }
-                    else
+                    simplifyInst(inst);
+                }
+            }
+
+            // Then the instructions whose operands were simplified are revisited until nothing changes. Value
+            // numbering runs on the simplified blocks, and the users of the duplicates it removes are revisited
+            bool changed = true;
+            while (changed)
+            {
+                while (!WorkList.empty())
+                {
+                    auto inst = WorkList.pop_back_val();
+                    if (replaced.count(inst) == 0)
                     {
-                        ++numConstFolding;
+                        simplifyInst(*inst);
                     }
-                    if (remove)
-                        toRemove.push_back(&inst);
                 }
 
-                for (size_t i = 0; i < toRemove.size(); ++i)
+                changed = false;
+                if (ValueNumbering)
                 {
-
-                    toRemove[i]->eraseFromParent();
+                    for (auto &bb : F)
+                    {
+                        changed |= numberValues(bb);
+                    }
                 }
             }
 
-            outs() << "Algebraic Identity : " << numAlgebraicIdentity << "\n";
-            outs() << "Strength Reduction : " << numStrengthReduction << "\n";
-            outs() << "Constant Folding : " << numConstFolding << "\n";
+            for (auto inst : toRemove)
+            {
+                inst->dropAllReferences();
+            }
+            for (auto inst : toRemove)
+            {
+                inst->eraseFromParent();
+            }
+
+            outs() << "Function " << F.getName() << "\n";
+            for (auto &hits : ruleHits)
+            {
+                outs() << hits.first << " : " << hits.second << "\n";
+            }
 
-            return true;
+            return !toRemove.empty() || folded.first > 0 || folded.second > 0;
         }
     };
 };
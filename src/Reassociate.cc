@@ -0,0 +1,324 @@
+#include "Common.h"
+
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace llvm;
+
+namespace
+{
+
+/**
+ * @brief Reassociation of the chains of associative and commutative operators (Add, Mul, And, Or, Xor).
+ * A chain is flattened into its leaves, which are sorted by rank and recombined as a left-linear
+ * tree: ((low + low) + high) + constant. The constants of a chain are combined into one, so (x + 3) + 5
+ * becomes x + 8, and chains over the same values get the same shape, which lets value numbering and
+ * CSE find their common parts
+ *
+ */
+class ReassociationPass : public FunctionPass
+{
+  public:
+    static char ID;
+
+    ReassociationPass() : FunctionPass(ID)
+    {
+    }
+
+    virtual bool runOnFunction(Function &F)
+    {
+        if (F.isDeclaration())
+        {
+            return false;
+        }
+
+        ranks.clear();
+        numChains = 0;
+        numConstants = 0;
+
+        ReversePostOrderTraversal<Function *> RPOT(&F);
+        computeRanks(F, RPOT);
+
+        bool changed = false;
+        for (auto BB : RPOT)
+        {
+            for (auto &I : make_early_inc_range(*BB))
+            {
+                if (isChainRoot(I))
+                {
+                    changed |= reassociate(cast<BinaryOperator>(I));
+                }
+            }
+        }
+
+        outs() << "Function " << F.getName() << " - Chains Reassociated : " << numChains
+               << ", Constants Combined : " << numConstants << "\n";
+
+        return changed;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+        AU.setPreservesCFG();
+    }
+
+  private:
+    DenseMap<Value *, unsigned> ranks;
+    unsigned numChains = 0;
+    unsigned numConstants = 0;
+
+    static bool isReassociable(Value *V)
+    {
+        auto BO = dyn_cast<BinaryOperator>(V);
+        if (BO == nullptr || !BO->getType()->isIntOrIntVectorTy())
+        {
+            return false;
+        }
+        switch (BO->getOpcode())
+        {
+        case Instruction::Add:
+        case Instruction::Mul:
+        case Instruction::And:
+        case Instruction::Or:
+        case Instruction::Xor:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Constants that can be folded with each other. Constant expressions (e.g on the address of a global) are leaves
+    static bool isFoldableConstant(Value *V)
+    {
+        return isa<Constant>(V) && !isa<ConstantExpr>(V) && !isa<GlobalValue>(V);
+    }
+
+    // An operand of a chain that is computed by the chain itself, and so can be rewritten with it
+    static bool isInterior(Value *V, BinaryOperator &root)
+    {
+        auto I = dyn_cast<Instruction>(V);
+        return I != nullptr && isReassociable(I) && I->getOpcode() == root.getOpcode() && I->hasOneUse() &&
+               I->getParent() == root.getParent();
+    }
+
+    // The last operator of a chain: its only user is not part of the same chain
+    static bool isChainRoot(Instruction &I)
+    {
+        if (!isReassociable(&I))
+        {
+            return false;
+        }
+        if (I.hasOneUse())
+        {
+            auto user = dyn_cast<BinaryOperator>(*I.user_begin());
+            return user == nullptr || !isInterior(&I, *user);
+        }
+        return true;
+    }
+
+    unsigned getRank(Value *V)
+    {
+        if (isa<Constant>(V) && !isa<GlobalValue>(V))
+        {
+            return 0;
+        }
+        return ranks.lookup(V);
+    }
+
+    /**
+     * @brief Ranks the values of the function. Arguments have the lowest ranks, then each block in reverse post
+     * order gets a higher base rank. Instructions that can not be moved (PHIs, memory accesses, calls) take
+     * the next rank of their block, the others the highest rank of their operands (plus one if they are not
+     * reassociable), so that the values available earliest are combined first
+     *
+     */
+    void computeRanks(Function &F, ReversePostOrderTraversal<Function *> &RPOT)
+    {
+        unsigned rank = 1;
+        for (auto &arg : F.args())
+        {
+            ranks[&arg] = ++rank;
+        }
+
+        unsigned blockRank = rank;
+        for (auto BB : RPOT)
+        {
+            unsigned instRank = ++blockRank << 16;
+            for (auto &I : *BB)
+            {
+                if (isa<PHINode>(&I) || I.mayReadOrWriteMemory() || I.mayHaveSideEffects())
+                {
+                    ranks[&I] = ++instRank;
+                    continue;
+                }
+                unsigned maxRank = 0;
+                for (auto &op : I.operands())
+                {
+                    maxRank = std::max(maxRank, getRank(op.get()));
+                }
+                ranks[&I] = isReassociable(&I) ? maxRank : maxRank + 1;
+            }
+        }
+    }
+
+    // Collects the leaves of the chain ending at V from left to right, and the operators they go through
+    void linearize(BinaryOperator &root, Value *V, SmallVectorImpl<Value *> &leaves,
+                   SmallVectorImpl<Instruction *> &interior)
+    {
+        if (V != &root && !isInterior(V, root))
+        {
+            leaves.push_back(V);
+            return;
+        }
+        auto I = cast<Instruction>(V);
+        interior.push_back(I);
+        linearize(root, I->getOperand(0), leaves, interior);
+        linearize(root, I->getOperand(1), leaves, interior);
+    }
+
+    // Whether the chain already is ((ops[0] op ops[1]) op ops[2]) ...
+    static bool hasShape(BinaryOperator &root, ArrayRef<Value *> ops)
+    {
+        Value *current = &root;
+        for (size_t i = ops.size() - 1; i > 0; --i)
+        {
+            auto I = dyn_cast<BinaryOperator>(current);
+            if (I == nullptr || (current != &root && !isInterior(I, root)) || I->getOperand(1) != ops[i])
+            {
+                return false;
+            }
+            current = I->getOperand(0);
+        }
+        return current == ops[0];
+    }
+
+    /**
+     * @brief Rewrites a chain with its leaves sorted by rank and its constants combined. And/Or drop duplicated
+     * leaves and Xor cancels them pairwise
+     *
+     * @return true if the chain was changed
+     */
+    bool reassociate(BinaryOperator &root)
+    {
+        auto opcode = root.getOpcode();
+        auto type = root.getType();
+
+        SmallVector<Value *, 8> leaves;
+        SmallVector<Instruction *, 8> interior;
+        linearize(root, &root, leaves, interior);
+
+        SmallVector<Value *, 8> ops;
+        Constant *constant = nullptr;
+        unsigned numFolded = 0;
+        for (auto leaf : leaves)
+        {
+            if (!isFoldableConstant(leaf))
+            {
+                ops.push_back(leaf);
+                continue;
+            }
+            auto C = cast<Constant>(leaf);
+            if (constant != nullptr)
+            {
+                C = ConstantFoldBinaryOpOperands(opcode, constant, C, root.getModule()->getDataLayout());
+                ++numFolded;
+            }
+            constant = C;
+        }
+
+        // Sorted by rank, leaves of the same rank keep their order
+        std::stable_sort(ops.begin(), ops.end(), [this](Value *a, Value *b) { return getRank(a) < getRank(b); });
+
+        if (opcode == Instruction::And || opcode == Instruction::Or || opcode == Instruction::Xor)
+        {
+            // x & x = x | x = x, and x ^ x = 0 so a leaf is kept once if it appears an odd number of times
+            DenseMap<Value *, unsigned> count;
+            for (auto op : ops)
+            {
+                ++count[op];
+            }
+            SmallVector<Value *, 8> unique;
+            for (auto op : ops)
+            {
+                auto &n = count[op];
+                if (n != 0 && (opcode != Instruction::Xor || n % 2 == 1))
+                {
+                    unique.push_back(op);
+                }
+                n = 0;
+            }
+            if (unique.size() < ops.size())
+            {
+                ++numFolded;
+            }
+            ops = unique;
+        }
+
+        auto identity = ConstantExpr::getBinOpIdentity(opcode, type);
+        auto absorber = ConstantExpr::getBinOpAbsorber(opcode, type);
+        if (constant != nullptr)
+        {
+            if (constant == absorber)
+            {
+                ops.clear();
+                ++numFolded;
+            }
+            if (constant != identity || ops.empty())
+            {
+                ops.push_back(constant);
+            }
+            else
+            {
+                ++numFolded;
+            }
+        }
+        if (ops.empty())
+        {
+            ops.push_back(identity);
+        }
+
+        if (numFolded == 0 && hasShape(root, ops))
+        {
+            return false;
+        }
+
+        outs() << "Chain " << getShortValueName(&root) << " of " << leaves.size() << " Operands Rewritten With "
+               << ops.size() << "\n";
+        ++numChains;
+        numConstants += numFolded;
+
+        IRBuilder<> builder(&root);
+        Value *result = ops[0];
+        for (size_t i = 1; i < ops.size(); ++i)
+        {
+            auto combined = builder.CreateBinOp(opcode, result, ops[i]);
+            ranks[combined] = std::max(getRank(result), getRank(ops[i]));
+            result = combined;
+        }
+        if (ops.size() > 1)
+        {
+            result->takeName(&root);
+            ranks[result] = getRank(&root);
+        }
+
+        root.replaceAllUsesWith(result);
+        // The operators of the old chain only used each other
+        for (auto I : interior)
+        {
+            I->dropAllReferences();
+        }
+        for (auto I : interior)
+        {
+            I->eraseFromParent();
+        }
+        return true;
+    }
+};
+
+char ReassociationPass::ID = 0;
+RegisterPass<ReassociationPass> X("reassociation", "Reassociation of Arithmetic Chains");
+} // namespace
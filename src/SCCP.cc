@@ -0,0 +1,56 @@
+#include "SCCP.h"
+
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace
+{
+
+class SCCPPass : public FunctionPass
+{
+  public:
+    static char ID;
+
+    SCCPPass() : FunctionPass(ID)
+    {
+    }
+
+    virtual bool runOnFunction(Function &F)
+    {
+        if (F.isDeclaration())
+        {
+            return false;
+        }
+
+        ConstantPropagationSolver solver(F);
+        solver.solve(F);
+
+        auto constantInsts = solver.getConstantInsts(F);
+        auto folded = solver.foldBranches(F);
+
+        for (auto &constantInst : constantInsts)
+        {
+            auto I = constantInst.first;
+            outs() << *I << " Folded To " << *constantInst.second << "\n";
+            I->replaceAllUsesWith(constantInst.second);
+            I->eraseFromParent();
+        }
+
+        outs() << "Function " << F.getName() << " - Constants : " << constantInsts.size()
+               << ", Branches Folded : " << folded.first << ", Blocks Deleted : " << folded.second << "\n";
+
+        return !constantInsts.empty() || folded.first > 0 || folded.second > 0;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const
+    {
+    }
+
+  private:
+};
+
+char SCCPPass::ID = 0;
+RegisterPass<SCCPPass> X("sparse-ccp", "Sparse Conditional Constant Propagation");
+} // namespace